@@ -4,6 +4,13 @@
 #include <stdio.h>
 #include "devices/ide.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Most sectors and buffer segments the dispatcher merges into
+   one transfer. */
+#define MERGE_MAX 64
+#define MERGE_SEG_MAX 32
 
 /* A block device. */
 struct block
@@ -19,6 +26,15 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long hit_cnt;         /* Number of buffer cache hits. */
+    unsigned long long miss_cnt;        /* Number of buffer cache misses. */
+
+    /* Request queue, for devices whose operations do not remap
+       requests onto another device. */
+    struct lock queue_lock;             /* Guards QUEUE and HEAD. */
+    struct condition queue_nonempty;    /* Signaled when a request arrives. */
+    struct list queue;                  /* Pending requests, by sector. */
+    block_sector_t head;                /* Sector after the last dispatched. */
   };
 
 /* List of all block devices. */
@@ -28,6 +44,8 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static list_less_func request_less;
+static thread_func dispatcher NO_RETURN;
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -99,18 +117,130 @@ block_get_by_name (const char *name)
   return NULL;
 }
 
-/* Verifies that SECTOR is a valid offset within BLOCK.
+/* Verifies that CNT sectors starting at SECTOR lie within BLOCK.
    Panics if not. */
 static void
-check_sector (struct block *block, block_sector_t sector)
+check_range (struct block *block, block_sector_t sector, block_sector_t cnt)
 {
-  if (sector >= block->size)
+  if (cnt > block->size || sector > block->size - cnt)
     {
       /* We do not use ASSERT because we want to panic here
          regardless of whether NDEBUG is defined. */
       PANIC ("Access past end of device %s (sector=%"PRDSNu", "
-             "size=%"PRDSNu")\n", block_name (block), sector, block->size);
+             "cnt=%"PRDSNu", size=%"PRDSNu")\n",
+             block_name (block), sector, cnt, block->size);
+    }
+}
+
+/* Initializes R to transfer CNT sectors starting at SECTOR
+   between a block device and BUFFER, which must have room for
+   CNT * BLOCK_SECTOR_SIZE bytes.  The transfer writes to the
+   device if WRITE is true and reads from it otherwise.
+
+   When R completes, COMPLETE is called with R and AUX from the
+   device's dispatcher thread or interrupt handler; it must not
+   sleep.  If
+   COMPLETE is null, wait for R with block_wait() instead. */
+void
+block_request_init (struct block_request *r, bool write,
+                    block_sector_t sector, block_sector_t cnt, void *buffer,
+                    block_request_func *complete, void *aux)
+{
+  ASSERT (r != NULL);
+  ASSERT (cnt > 0);
+
+  r->seg.buffer = buffer;
+  r->seg.cnt = cnt;
+  block_request_init_sg (r, write, sector, &r->seg, 1, complete, aux);
+}
+
+/* Initializes R like block_request_init(), but to transfer
+   between consecutive sectors starting at SECTOR and the SEG_CNT
+   buffers in SEGS, in order.  SEGS must stay alive until R
+   completes. */
+void
+block_request_init_sg (struct block_request *r, bool write,
+                       block_sector_t sector,
+                       const struct block_segment *segs, size_t seg_cnt,
+                       block_request_func *complete, void *aux)
+{
+  size_t i;
+
+  ASSERT (r != NULL);
+  ASSERT (seg_cnt > 0 && seg_cnt <= BLOCK_SEG_MAX);
+
+  r->write = write;
+  r->sector = sector;
+  r->cnt = 0;
+  for (i = 0; i < seg_cnt; i++)
+    {
+      ASSERT (segs[i].cnt > 0);
+      r->cnt += segs[i].cnt;
+    }
+  r->segs = segs;
+  r->seg_cnt = seg_cnt;
+  r->complete = complete;
+  r->aux = aux;
+  sema_init (&r->done, 0);
+}
+
+/* Queues R, which must have been initialized with
+   block_request_init(), for BLOCK and returns without waiting for
+   it.  R must stay alive until it completes.
+   Requests on a partition are queued for the disk holding it.
+   Requests on a device with its own queue go straight to its
+   driver. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  for (;;)
+    {
+      check_range (block, r->sector, r->cnt);
+      if (r->write)
+        {
+          ASSERT (block->type != BLOCK_FOREIGN);
+          block->write_cnt += r->cnt;
+        }
+      else
+        block->read_cnt += r->cnt;
+
+      if (block->ops->remap == NULL)
+        break;
+      block = block->ops->remap (block->aux, &r->sector);
+    }
+
+  if (block->ops->submit != NULL)
+    {
+      block->ops->submit (block->aux, r);
+      return;
     }
+
+  lock_acquire (&block->queue_lock);
+  list_insert_ordered (&block->queue, &r->elem, request_less, NULL);
+  cond_signal (&block->queue_nonempty, &block->queue_lock);
+  lock_release (&block->queue_lock);
+}
+
+/* Waits for R, which must have been submitted without a
+   completion callback, to complete. */
+void
+block_wait (struct block_request *r)
+{
+  ASSERT (r->complete == NULL);
+  sema_down (&r->done);
+}
+
+/* Marks R complete, by calling its completion callback or
+   waking up its waiter.  Called by the dispatcher thread and by
+   drivers that take requests through their SUBMIT operation.
+   May be called from an interrupt handler. */
+void
+block_complete (struct block_request *r)
+{
+  if (r->complete != NULL)
+    r->complete (r, r->aux);
+  else
+    sema_up (&r->done);
 }
 
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
@@ -120,9 +250,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_range (block, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +261,184 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_range (block, sector, 1, buffer);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Drivers that support it transfer the whole range with as few
+   commands as possible.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_range (struct block *block, block_sector_t sector,
+                  block_sector_t cnt, void *buffer)
+{
+  struct block_request r;
+
+  block_request_init (&r, false, sector, cnt, buffer, NULL, NULL);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving the
+   data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_range (struct block *block, block_sector_t sector,
+                   block_sector_t cnt, const void *buffer)
+{
+  struct block_request r;
+
+  block_request_init (&r, true, sector, cnt, (void *) buffer, NULL, NULL);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Orders requests by starting sector. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request, elem);
+  const struct block_request *b = list_entry (b_, struct block_request, elem);
+  return a->sector < b->sector;
+}
+
+/* Has BLOCK's driver transfer CNT sectors starting at SECTOR
+   to or from BUFFER. */
+static void
+transfer (struct block *block, bool write, block_sector_t sector,
+          block_sector_t cnt, uint8_t *buffer)
+{
+  const struct block_operations *ops = block->ops;
+  block_sector_t i;
+
+  if (write && ops->write_range != NULL)
+    ops->write_range (block->aux, sector, cnt, buffer);
+  else if (!write && ops->read_range != NULL)
+    ops->read_range (block->aux, sector, cnt, buffer);
+  else
+    for (i = 0; i < cnt; i++)
+      if (write)
+        ops->write (block->aux, sector + i, buffer + i * BLOCK_SECTOR_SIZE);
+      else
+        ops->read (block->aux, sector + i, buffer + i * BLOCK_SECTOR_SIZE);
+}
+
+/* Has BLOCK's driver transfer the SEG_CNT buffers in SEGS to or
+   from consecutive sectors starting at SECTOR, in one command if
+   the driver supports scatter-gather, otherwise one segment at a
+   time. */
+static void
+transfer_sg (struct block *block, bool write, block_sector_t sector,
+             const struct block_segment *segs, size_t seg_cnt)
+{
+  size_t i;
+
+  if (block->ops->transfer_sg != NULL)
+    block->ops->transfer_sg (block->aux, write, sector, segs, seg_cnt);
+  else
+    for (i = 0; i < seg_cnt; i++)
+      {
+        transfer (block, write, sector, segs[i].cnt, segs[i].buffer);
+        sector += segs[i].cnt;
+      }
+}
+
+/* Dispatcher thread for BLOCK_.  Serves BLOCK_'s queue in C-LOOK
+   order: it sweeps upward through the pending sectors, then
+   jumps back to the lowest one.  Requests that continue the one
+   being served, in the same direction, are merged into a single
+   driver transfer of up to MERGE_MAX sectors.  The merged
+   transfer lists each request's own buffers, up to MERGE_SEG_MAX
+   of them, so that data always moves straight to or from the
+   requester's memory. */
+static void
+dispatcher (void *block_)
+{
+  struct block *block = block_;
+
+  for (;;)
+    {
+      struct block_segment segs[MERGE_SEG_MAX];
+      size_t seg_cnt;
+      struct list batch;
+      struct list_elem *e;
+      struct block_request *first;
+      block_sector_t sector, cnt;
+      bool write;
+
+      lock_acquire (&block->queue_lock);
+      while (list_empty (&block->queue))
+        cond_wait (&block->queue_nonempty, &block->queue_lock);
+
+      for (e = list_begin (&block->queue); e != list_end (&block->queue);
+           e = list_next (e))
+        if (list_entry (e, struct block_request, elem)->sector >= block->head)
+          break;
+      if (e == list_end (&block->queue))
+        e = list_begin (&block->queue);
+
+      first = list_entry (e, struct block_request, elem);
+      sector = first->sector;
+      cnt = first->cnt;
+      seg_cnt = first->seg_cnt;
+      write = first->write;
+      e = list_remove (e);
+      list_init (&batch);
+      list_push_back (&batch, &first->elem);
+      while (e != list_end (&block->queue))
+        {
+          struct block_request *r = list_entry (e, struct block_request,
+                                                elem);
+          if (r->write != write || r->sector != sector + cnt
+              || cnt + r->cnt > MERGE_MAX
+              || seg_cnt + r->seg_cnt > MERGE_SEG_MAX)
+            break;
+          cnt += r->cnt;
+          seg_cnt += r->seg_cnt;
+          e = list_remove (e);
+          list_push_back (&batch, &r->elem);
+        }
+      block->head = sector + cnt;
+      lock_release (&block->queue_lock);
+
+      /* List the batch's buffers in sector order, joining those
+         that are adjacent in memory. */
+      seg_cnt = 0;
+      for (e = list_begin (&batch); e != list_end (&batch);
+           e = list_next (e))
+        {
+          struct block_request *r = list_entry (e, struct block_request,
+                                                elem);
+          size_t i;
+
+          for (i = 0; i < r->seg_cnt; i++)
+            {
+              const struct block_segment *seg = &r->segs[i];
+
+              if (seg_cnt > 0
+                  && ((uint8_t *) segs[seg_cnt - 1].buffer
+                      + segs[seg_cnt - 1].cnt * BLOCK_SECTOR_SIZE)
+                     == seg->buffer)
+                segs[seg_cnt - 1].cnt += seg->cnt;
+              else
+                segs[seg_cnt++] = *seg;
+            }
+        }
+      transfer_sg (block, write, sector, segs, seg_cnt);
+
+      while (!list_empty (&batch))
+        {
+          struct block_request *r = list_entry (list_pop_front (&batch),
+                                                struct block_request, elem);
+          block_complete (r);
+        }
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -174,10 +476,25 @@ block_print_stats (void)
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
                   block->read_cnt, block->write_cnt);
+          if (block->hit_cnt + block->miss_cnt > 0)
+            printf ("%s (%s): %llu cache hits, %llu cache misses\n",
+                    block->name, block_type_name (block->type),
+                    block->hit_cnt, block->miss_cnt);
         }
     }
 }
 
+/* Records a buffer cache hit (if HIT is true) or miss for a
+   sector of BLOCK, for block_print_stats(). */
+void
+block_account_cache (struct block *block, bool hit)
+{
+  if (hit)
+    block->hit_cnt++;
+  else
+    block->miss_cnt++;
+}
+
 /* Registers a new block device with the given NAME.  If
    EXTRA_INFO is non-null, it is printed as part of a user
    message.  The block device's SIZE in sectors and its TYPE must
@@ -200,6 +517,20 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->hit_cnt = 0;
+  block->miss_cnt = 0;
+
+  lock_init (&block->queue_lock);
+  cond_init (&block->queue_nonempty);
+  list_init (&block->queue);
+  block->head = 0;
+  if (ops->remap == NULL && ops->submit == NULL)
+    {
+      char thread_name[16];
+
+      snprintf (thread_name, sizeof thread_name, "%s-io", name);
+      thread_create (thread_name, PRI_MAX, dispatcher, block);
+    }
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
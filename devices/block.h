@@ -1,8 +1,11 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,11 +56,58 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_range (struct block *, block_sector_t, block_sector_t cnt,
+                       void *);
+void block_write_range (struct block *, block_sector_t, block_sector_t cnt,
+                        const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* A piece of a scatter-gather transfer: CNT whole sectors at
+   BUFFER, which must be a kernel address and contiguous in
+   physical memory, as any range within one page is. */
+struct block_segment
+  {
+    void *buffer;                       /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    block_sector_t cnt;                 /* Number of sectors. */
+  };
+
+/* Most segments in one request. */
+#define BLOCK_SEG_MAX 8
+
+/* Asynchronous requests.  block_read() and the other calls
+   above submit one of these and wait for it. */
+struct block_request;
+typedef void block_request_func (struct block_request *, void *aux);
+struct block_request
+  {
+    struct list_elem elem;              /* Element in device queue. */
+    bool write;                         /* Write to device? */
+    block_sector_t sector;              /* First sector. */
+    block_sector_t cnt;                 /* Number of sectors. */
+    const struct block_segment *segs;   /* Buffers for consecutive sectors,
+                                           CNT sectors in all. */
+    size_t seg_cnt;                     /* Number of SEGS, at most
+                                           BLOCK_SEG_MAX. */
+    struct block_segment seg;           /* SEGS for a single buffer. */
+    block_request_func *complete;       /* Completion callback, or null. */
+    void *aux;                          /* Passed to COMPLETE. */
+    struct semaphore done;              /* Up'd on completion if no COMPLETE. */
+  };
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t, block_sector_t cnt, void *buffer,
+                         block_request_func *, void *aux);
+void block_request_init_sg (struct block_request *, bool write,
+                            block_sector_t, const struct block_segment *,
+                            size_t seg_cnt, block_request_func *, void *aux);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
+void block_complete (struct block_request *);
+
 /* Statistics. */
 void block_print_stats (void);
+void block_account_cache (struct block *, bool hit);
 
 /* Lower-level interface to block device drivers. */
 
@@ -65,6 +115,35 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional: transfer CNT consecutive sectors at once.  If
+       null, the block layer issues one READ or WRITE per sector. */
+    void (*read_range) (void *aux, block_sector_t, block_sector_t cnt,
+                        void *buffer);
+    void (*write_range) (void *aux, block_sector_t, block_sector_t cnt,
+                         const void *buffer);
+
+    /* Optional: transfer the SEG_CNT buffers in SEGS to or from
+       consecutive sectors, writing if WRITE is true, with as few
+       commands as possible.  If null, the block layer transfers
+       one segment at a time. */
+    void (*transfer_sg) (void *aux, bool write, block_sector_t,
+                         const struct block_segment *segs, size_t seg_cnt);
+
+    /* For devices layered on another one, such as partitions:
+       returns the underlying device and translates *SECTOR into
+       it.  Requests are then queued on that device, and the other
+       operations are never called. */
+    struct block *(*remap) (void *aux, block_sector_t *sector);
+
+    /* For devices that keep their own queue of requests in
+       flight, such as virtio disks: starts R and returns without
+       waiting for it.  The driver calls block_complete() on R once
+       it finishes, possibly from an interrupt handler.  Requests
+       are handed to SUBMIT as they arrive, without the block
+       layer's queueing, and the other operations are never
+       called. */
+    void (*submit) (void *aux, struct block_request *r);
   };
 
 struct block *block_register (const char *name, enum block_type,
@@ -5,10 +5,13 @@
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -30,10 +33,39 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus master IDE port addresses, relative to the channel's
+   bus master base (PCI BAR 4, plus 8 for the secondary channel). */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0)  /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)   /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)     /* PRD table. */
+
+/* Bus master command and status register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+#define BM_STA_ERR 0x02         /* Transfer failed. */
+#define BM_STA_INTR 0x04        /* Disk raised its interrupt. */
+
+/* PCI class of IDE controllers; the programming interface bits
+   say whether each channel uses the legacy ports. */
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+#define PCI_IDE_NATIVE(CHAN_NO) (1 << (2 * (CHAN_NO)))
+
+/* Physical region descriptor, an entry in a bus master PRD
+   table.  A region must not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address of region. */
+    uint16_t size;              /* Size in bytes, 0 meaning 64 kB. */
+    uint16_t flags;             /* PRD_EOT in the last entry. */
+  };
+#define PRD_EOT 0x8000
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +81,15 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Most sectors transferred by one command.  The sector count
+   register is 8 bits wide, with 0 meaning 256. */
+#define MAX_XFER_SECTORS 256
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +98,9 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per interrupt for READ/WRITE
+                                   MULTIPLE, or 1 if not enabled. */
+    bool dma;                   /* Does the disk support DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -72,6 +116,9 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus master base port, 0 if no DMA. */
+    struct prd *prdt;           /* Page holding the PRD table. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -85,10 +132,16 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sectors (struct ata_disk *, block_sector_t,
+                            block_sector_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
-static void input_sector (struct channel *, void *);
-static void output_sector (struct channel *, const void *);
+static void input_sectors (struct channel *, void *, int cnt);
+static void output_sectors (struct channel *, const void *, int cnt);
+static void set_multiple_mode (struct ata_disk *, int max_multiple);
+static uint16_t find_bus_master (void);
+static bool dma_transfer (struct ata_disk *, block_sector_t,
+                          const struct block_segment *, size_t seg_cnt,
+                          bool write);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -102,6 +155,7 @@ void
 ide_init (void) 
 {
   size_t chan_no;
+  uint16_t bm_base = find_bus_master ();
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
@@ -126,6 +180,16 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+
+      /* Set up bus master DMA, if the controller supports it. */
+      c->bm_base = 0;
+      c->prdt = NULL;
+      if (bm_base != 0)
+        {
+          c->prdt = palloc_get_page (0);
+          if (c->prdt != NULL)
+            c->bm_base = bm_base + chan_no * 8;
+        }
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +200,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 1;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -279,7 +345,7 @@ identify_ata_device (struct ata_disk *d)
       d->is_ata = false;
       return;
     }
-  input_sector (c, id);
+  input_sectors (c, id, 1);
 
   /* Calculate capacity.
      Read model name and serial number. */
@@ -303,6 +369,13 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Word 49 bit 8 says whether the disk can do DMA. */
+  d->dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x100) != 0;
+
+  /* Transfer as many sectors per interrupt as the disk allows.
+     The low byte of word 47 is that maximum. */
+  set_multiple_mode (d, (uint8_t) id[47 * 2]);
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
@@ -337,63 +410,307 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Looks for a PCI IDE controller whose channels both use the
+   legacy ports and that can act as a bus master.  Returns the
+   base of its bus master ports, or 0 if there is none, in which
+   case all transfers use PIO. */
+static uint16_t
+find_bus_master (void)
+{
+  struct pci_addr pci;
+  uint32_t prog_if;
+  uint16_t bm_base;
+
+  if (!pci_find_class (PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &pci))
+    return 0;
+  prog_if = (pci_read_config (&pci, PCI_REG_CLASS) >> 8) & 0xff;
+  if (prog_if & (PCI_IDE_NATIVE (0) | PCI_IDE_NATIVE (1)))
+    return 0;
+  bm_base = pci_io_bar (&pci, 4);
+  if (bm_base != 0)
+    pci_enable_bus_master (&pci);
+  return bm_base;
+}
+
+/* Transfers the SEG_CNT buffers in SEGS to or from consecutive
+   sectors of disk D starting at SEC_NO, with a single command, by
+   bus master DMA, writing to the disk if WRITE is true and
+   reading from it otherwise.  The CPU is free to run other
+   threads until the completion interrupt.  Returns false, having
+   done nothing, if DMA cannot be used for this transfer, so that
+   the caller should fall back to PIO.  D's channel lock must be
+   held. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no,
+              const struct block_segment *segs, size_t seg_cnt, bool write)
+{
+  struct channel *c = d->channel;
+  struct prd *prd = c->prdt;
+  uint8_t direction = write ? 0 : BM_CMD_READ;
+  block_sector_t cnt = 0;
+  size_t i;
+
+  if (!d->dma)
+    return false;
+  for (i = 0; i < seg_cnt; i++)
+    {
+      if (((uintptr_t) segs[i].buffer & 1) != 0)
+        return false;
+      cnt += segs[i].cnt;
+    }
+  if (cnt == 0 || cnt > MAX_XFER_SECTORS)
+    return false;
+
+  /* Describe each buffer one page at a time, which keeps each
+     region within a 64 kB boundary.  The PRD table has room for
+     many more regions than a command can span pages. */
+  for (i = 0; i < seg_cnt; i++)
+    {
+      const uint8_t *p = segs[i].buffer;
+      size_t left = segs[i].cnt * BLOCK_SECTOR_SIZE;
+
+      while (left > 0)
+        {
+          size_t size = PGSIZE - pg_ofs (p);
+          if (size > left)
+            size = left;
+          ASSERT (prd < c->prdt + PGSIZE / sizeof *prd);
+          prd->addr = vtop (p);
+          prd->size = size;
+          prd->flags = 0;
+          prd++;
+          p += size;
+          left -= size;
+        }
+    }
+  prd[-1].flags = PRD_EOT;
+
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c), inb (reg_bm_status (c)) | BM_STA_ERR | BM_STA_INTR);
+
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), direction | BM_CMD_START);
+  sema_down (&c->completion_wait);
+  outb (reg_bm_command (c), direction);
+
+  if ((inb (reg_bm_status (c)) & BM_STA_ERR)
+      || (inb (reg_alt_status (c)) & STA_ERR))
+    PANIC ("%s: disk DMA %s failed, sector=%"PRDSNu,
+           d->name, write ? "write" : "read", sec_no);
+  return true;
+}
+
+/* Issues SET MULTIPLE MODE to disk D with the largest power of 2
+   no greater than MAX_MULTIPLE, and records the result in D.
+   Leaves D transferring one sector per interrupt if the disk
+   does not support READ/WRITE MULTIPLE or rejects the command. */
+static void
+set_multiple_mode (struct ata_disk *d, int max_multiple)
+{
+  struct channel *c = d->channel;
+  int multiple = 1;
+
+  while (multiple * 2 <= max_multiple)
+    multiple *= 2;
+  if (multiple < 2)
+    return;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), multiple);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if (!(inb (reg_alt_status (c)) & STA_ERR))
+    d->multiple = multiple;
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.  Each
+   command covers up to MAX_XFER_SECTORS sectors.  DMA is used if
+   possible; otherwise the disk interrupts once per D->multiple
+   sectors of PIO.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_range (void *d_, block_sector_t sec_no, block_sector_t cnt,
+                void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0)
+    {
+      block_sector_t xfer = cnt < MAX_XFER_SECTORS ? cnt : MAX_XFER_SECTORS;
+      struct block_segment seg;
+      block_sector_t done;
+
+      seg.buffer = buffer;
+      seg.cnt = xfer;
+      if (dma_transfer (d, sec_no, &seg, 1, false))
+        {
+          buffer += xfer * BLOCK_SECTOR_SIZE;
+          sec_no += xfer;
+          cnt -= xfer;
+          continue;
+        }
+
+      select_sectors (d, sec_no, xfer);
+      issue_pio_command (c, (d->multiple > 1 ? CMD_READ_MULTIPLE
+                             : CMD_READ_SECTOR_RETRY));
+      for (done = 0; done < xfer; )
+        {
+          int n = xfer - done < (block_sector_t) d->multiple
+                  ? (int) (xfer - done) : d->multiple;
+
+          sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                   d->name, sec_no + done);
+          input_sectors (c, buffer, n);
+          buffer += n * BLOCK_SECTOR_SIZE;
+          done += n;
+        }
+      sec_no += xfer;
+      cnt -= xfer;
+    }
+  lock_release (&c->lock);
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes.  Returns
+   after the disk has acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write_range (void *d_, block_sector_t sec_no, block_sector_t cnt,
+                 const void *buffer_)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+
+  lock_acquire (&c->lock);
+  while (cnt > 0)
+    {
+      block_sector_t xfer = cnt < MAX_XFER_SECTORS ? cnt : MAX_XFER_SECTORS;
+      struct block_segment seg;
+      block_sector_t done;
+
+      seg.buffer = (uint8_t *) buffer;
+      seg.cnt = xfer;
+      if (dma_transfer (d, sec_no, &seg, 1, true))
+        {
+          buffer += xfer * BLOCK_SECTOR_SIZE;
+          sec_no += xfer;
+          cnt -= xfer;
+          continue;
+        }
+
+      select_sectors (d, sec_no, xfer);
+      issue_pio_command (c, (d->multiple > 1 ? CMD_WRITE_MULTIPLE
+                             : CMD_WRITE_SECTOR_RETRY));
+      for (done = 0; done < xfer; )
+        {
+          int n = xfer - done < (block_sector_t) d->multiple
+                  ? (int) (xfer - done) : d->multiple;
+
+          /* The disk interrupts when it is ready for each block
+             after the first. */
+          if (done > 0)
+            sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, sec_no + done);
+          output_sectors (c, buffer, n);
+          buffer += n * BLOCK_SECTOR_SIZE;
+          done += n;
+        }
+      sema_down (&c->completion_wait);
+      sec_no += xfer;
+      cnt -= xfer;
+    }
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ide_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  ide_read_range (d, sec_no, 1, buffer);
+}
+
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
    BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+   acknowledged receiving the data. */
+static void
+ide_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_range (d, sec_no, 1, buffer);
+}
+
+/* Transfers the SEG_CNT buffers in SEGS to or from consecutive
+   sectors of disk D starting at SEC_NO, writing if WRITE is true.
+   With DMA, a transfer of up to MAX_XFER_SECTORS sectors is a
+   single command whose PRD table points at each buffer in turn;
+   otherwise each buffer is transferred by itself.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_transfer_sg (void *d_, bool write, block_sector_t sec_no,
+                 const struct block_segment *segs, size_t seg_cnt)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  bool done;
+  size_t i;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  done = dma_transfer (d, sec_no, segs, seg_cnt, write);
   lock_release (&c->lock);
+  if (done)
+    return;
+
+  for (i = 0; i < seg_cnt; i++)
+    {
+      if (write)
+        ide_write_range (d, sec_no, segs[i].cnt, segs[i].buffer);
+      else
+        ide_read_range (d, sec_no, segs[i].cnt, segs[i].buffer);
+      sec_no += segs[i].cnt;
+    }
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_range,
+    ide_write_range,
+    ide_transfer_sg,
+    NULL,
+    NULL
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT, which must be between 1 and
+   MAX_XFER_SECTORS, to the disk's sector selection registers.
+   (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no,
+                block_sector_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_XFER_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_XFER_SECTORS ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -402,7 +719,8 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
 }
 
 /* Writes COMMAND to channel C and prepares for receiving a
-   completion interrupt. */
+   completion interrupt.  Also used for DMA and non-data
+   commands. */
 static void
 issue_pio_command (struct channel *c, uint8_t command) 
 {
@@ -414,20 +732,22 @@ issue_pio_command (struct channel *c, uint8_t command)
   outb (reg_command (c), command);
 }
 
-/* Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
+/* Reads CNT sectors from channel C's data register in PIO mode
+   into SECTORS, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-input_sector (struct channel *c, void *sector) 
+input_sectors (struct channel *c, void *sectors, int cnt) 
 {
-  insw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  insw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain BLOCK_SECTOR_SIZE bytes. */
+/* Writes CNT sectors from SECTORS to channel C's data register in
+   PIO mode.  SECTORS must contain CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-output_sector (struct channel *c, const void *sector) 
+output_sectors (struct channel *c, const void *sectors, int cnt) 
 {
-  outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  outsw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
 /* Low-level ATA primitives. */
@@ -0,0 +1,143 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* The code in this file uses PCI configuration mechanism #1,
+   which every PC chipset that Pintos runs on supports. */
+
+/* Configuration space access ports. */
+#define PCI_CONFIG_ADDR 0xcf8           /* Address of register to access. */
+#define PCI_CONFIG_DATA 0xcfc           /* Data for that register. */
+
+/* Returns the configuration address of register REG of A. */
+static uint32_t
+config_address (const struct pci_addr *a, uint8_t reg)
+{
+  ASSERT (a->dev < 32 && a->func < 8);
+  return (0x80000000 | ((uint32_t) a->bus << 16) | ((uint32_t) a->dev << 11)
+          | ((uint32_t) a->func << 8) | (reg & 0xfc));
+}
+
+/* Reads the 32-bit configuration register at byte offset REG,
+   which must be a multiple of 4, of PCI function A. */
+uint32_t
+pci_read_config (const struct pci_addr *a, uint8_t reg)
+{
+  outl (PCI_CONFIG_ADDR, config_address (a, reg));
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit configuration register at byte
+   offset REG, which must be a multiple of 4, of PCI function
+   A. */
+void
+pci_write_config (const struct pci_addr *a, uint8_t reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDR, config_address (a, reg));
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Calls FUNC for each function present on any PCI bus, passing
+   its address, its vendor ID and device ID register, and AUX.
+   Stops early, returning true, as soon as FUNC returns true.
+   Returns false if FUNC never does. */
+bool
+pci_scan (pci_scan_func *func_, void *aux)
+{
+  struct pci_addr a;
+  unsigned bus, dev, func;
+
+  for (bus = 0; bus < 256; bus++)
+    for (dev = 0; dev < 32; dev++)
+      for (func = 0; func < 8; func++)
+        {
+          uint32_t id;
+
+          a.bus = bus;
+          a.dev = dev;
+          a.func = func;
+          id = pci_read_config (&a, PCI_REG_ID);
+          if ((id & 0xffff) == 0xffff)
+            {
+              /* No such function.  If function 0 is absent, so is
+                 the whole device. */
+              if (func == 0)
+                break;
+              continue;
+            }
+
+          if (func_ (&a, id, aux))
+            return true;
+
+          /* Only multifunction devices have functions past 0. */
+          if (func == 0
+              && !(pci_read_config (&a, PCI_REG_HEADER) & 0x00800000))
+            break;
+        }
+  return false;
+}
+
+/* Class search state for pci_find_class(). */
+struct class_search
+  {
+    uint8_t class, subclass;    /* Class codes wanted. */
+    struct pci_addr *a;         /* Receives the address found. */
+  };
+
+/* pci_scan() callback for pci_find_class(). */
+static bool
+match_class (const struct pci_addr *a, uint32_t id UNUSED, void *search_)
+{
+  struct class_search *search = search_;
+  uint32_t class_reg = pci_read_config (a, PCI_REG_CLASS);
+
+  if ((class_reg >> 24) != search->class
+      || ((class_reg >> 16) & 0xff) != search->subclass)
+    return false;
+  *search->a = *a;
+  return true;
+}
+
+/* Searches all PCI buses for the first function with the given
+   CLASS and SUBCLASS codes.  If one is found, stores its address
+   in *A and returns true; otherwise, returns false. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_addr *a)
+{
+  struct class_search search;
+
+  search.class = class;
+  search.subclass = subclass;
+  search.a = a;
+  return pci_scan (match_class, &search);
+}
+
+/* Returns the I/O port base in base address register BAR of A,
+   or 0 if BAR is unset or maps memory rather than I/O space. */
+uint32_t
+pci_io_bar (const struct pci_addr *a, int bar)
+{
+  uint32_t value;
+
+  ASSERT (bar >= 0 && bar < 6);
+  value = pci_read_config (a, PCI_REG_BAR0 + bar * 4);
+  return (value & 1) ? value & ~3u : 0;
+}
+
+/* Allows A to access I/O space and to act as a bus master. */
+void
+pci_enable_bus_master (const struct pci_addr *a)
+{
+  uint32_t cmd = pci_read_config (a, PCI_REG_COMMAND);
+  pci_write_config (a, PCI_REG_COMMAND,
+                    (cmd & 0xffff) | PCI_CMD_IO | PCI_CMD_BUS_MASTER);
+}
+
+/* Returns the legacy interrupt line (IRQ 0...15) that A is routed
+   to, or -1 if it has none. */
+int
+pci_irq (const struct pci_addr *a)
+{
+  int irq = pci_read_config (a, PCI_REG_IRQ) & 0xff;
+  return irq < 16 ? irq : -1;
+}
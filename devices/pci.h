@@ -0,0 +1,42 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Location of a PCI function in configuration space. */
+struct pci_addr
+  {
+    uint8_t bus;                /* Bus number, 0...255. */
+    uint8_t dev;                /* Device number, 0...31. */
+    uint8_t func;               /* Function number, 0...7. */
+  };
+
+/* Standard configuration space registers. */
+#define PCI_REG_ID 0x00                 /* Vendor ID, device ID. */
+#define PCI_REG_COMMAND 0x04            /* Command, status. */
+#define PCI_REG_CLASS 0x08              /* Revision, prog IF, subclass, class. */
+#define PCI_REG_HEADER 0x0c             /* Header type in bits 16...23. */
+#define PCI_REG_BAR0 0x10               /* First base address register. */
+#define PCI_REG_IRQ 0x3c                /* Interrupt line in bits 0...7. */
+
+/* Command register bits. */
+#define PCI_CMD_IO 0x0001               /* Respond to I/O space accesses. */
+#define PCI_CMD_MEMORY 0x0002           /* Respond to memory accesses. */
+#define PCI_CMD_BUS_MASTER 0x0004       /* May initiate DMA. */
+
+uint32_t pci_read_config (const struct pci_addr *, uint8_t reg);
+void pci_write_config (const struct pci_addr *, uint8_t reg, uint32_t);
+
+/* Called by pci_scan() for each function present.  ID is the
+   function's PCI_REG_ID register: device ID in the high 16 bits,
+   vendor ID in the low 16 bits. */
+typedef bool pci_scan_func (const struct pci_addr *, uint32_t id, void *aux);
+bool pci_scan (pci_scan_func *, void *aux);
+
+bool pci_find_class (uint8_t class, uint8_t subclass, struct pci_addr *);
+uint32_t pci_io_bar (const struct pci_addr *, int bar);
+int pci_irq (const struct pci_addr *);
+void pci_enable_bus_master (const struct pci_addr *);
+
+#endif /* devices/pci.h */
@@ -0,0 +1,117 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* The code in this file implements a block device held entirely
+   in memory.  Its contents start out zeroed and are lost at
+   shutdown, so it is useful mainly for benchmarking the file
+   system without disk latency and as fast scratch or swap
+   space. */
+
+/* Sectors per page of backing store. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A RAM disk. */
+struct ramdisk
+  {
+    size_t page_cnt;            /* Number of pages in PAGES. */
+    uint8_t **pages;            /* Backing pages, allocated one by one. */
+  };
+
+static struct block_operations ramdisk_operations;
+
+/* Creates a RAM disk named "ram0" of KB kilobytes, rounded down
+   to a whole number of pages, and registers it with the block
+   layer.  Use the -filesys, -scratch or -swap options to assign
+   it a role. */
+void
+ramdisk_init (size_t kb)
+{
+  struct ramdisk *rd;
+  size_t i;
+
+  rd = malloc (sizeof *rd);
+  if (rd == NULL)
+    PANIC ("ramdisk: out of memory");
+  rd->page_cnt = kb * 1024 / PGSIZE;
+  if (rd->page_cnt == 0)
+    PANIC ("ramdisk: size must be at least %d kB", PGSIZE / 1024);
+  rd->pages = malloc (rd->page_cnt * sizeof *rd->pages);
+  if (rd->pages == NULL)
+    PANIC ("ramdisk: out of memory");
+  for (i = 0; i < rd->page_cnt; i++)
+    {
+      rd->pages[i] = palloc_get_page (PAL_ZERO);
+      if (rd->pages[i] == NULL)
+        PANIC ("ramdisk: out of memory after %zu of %zu pages",
+               i, rd->page_cnt);
+    }
+
+  block_register ("ram0", BLOCK_RAW, "RAM disk",
+                  rd->page_cnt * SECTORS_PER_PAGE, &ramdisk_operations, rd);
+}
+
+/* Returns the address of sector SECTOR in RD's backing store. */
+static uint8_t *
+sector_addr (struct ramdisk *rd, block_sector_t sector)
+{
+  ASSERT (sector / SECTORS_PER_PAGE < rd->page_cnt);
+  return (rd->pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads CNT sectors starting at SECTOR from RD_ into BUFFER. */
+static void
+ramdisk_read_range (void *rd_, block_sector_t sector, block_sector_t cnt,
+                    void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+  block_sector_t i;
+
+  for (i = 0; i < cnt; i++)
+    memcpy (buffer + i * BLOCK_SECTOR_SIZE, sector_addr (rd_, sector + i),
+            BLOCK_SECTOR_SIZE);
+}
+
+/* Writes CNT sectors starting at SECTOR to RD_ from BUFFER. */
+static void
+ramdisk_write_range (void *rd_, block_sector_t sector, block_sector_t cnt,
+                     const void *buffer_)
+{
+  const uint8_t *buffer = buffer_;
+  block_sector_t i;
+
+  for (i = 0; i < cnt; i++)
+    memcpy (sector_addr (rd_, sector + i), buffer + i * BLOCK_SECTOR_SIZE,
+            BLOCK_SECTOR_SIZE);
+}
+
+/* Reads sector SECTOR from RD_ into BUFFER. */
+static void
+ramdisk_read (void *rd_, block_sector_t sector, void *buffer)
+{
+  ramdisk_read_range (rd_, sector, 1, buffer);
+}
+
+/* Writes sector SECTOR to RD_ from BUFFER. */
+static void
+ramdisk_write (void *rd_, block_sector_t sector, const void *buffer)
+{
+  ramdisk_write_range (rd_, sector, 1, buffer);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_read_range,
+    ramdisk_write_range,
+    NULL,
+    NULL,
+    NULL
+  };
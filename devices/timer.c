@@ -16,17 +16,66 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Hierarchical timer wheel holding every pending ktimer.
+
+   Level L has WHEEL_SIZE slots and holds the timers that expire
+   less than WHEEL_SIZE^(L+1) ticks after wheel_ticks, hashed by
+   bits [L * WHEEL_BITS, (L + 1) * WHEEL_BITS) of their expiry
+   tick.  Each time level L wraps around, the matching slot of
+   level L + 1 is cascaded, that is, its timers are re-inserted
+   and land one level lower.  Insertion and cancellation are
+   O(1) and each timer is cascaded at most WHEEL_LEVELS - 1
+   times, so expiry costs amortized O(1) per timer. */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_SPAN ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+
+static struct list wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static int64_t wheel_ticks;     /* Next tick the wheel will process. */
+
+/* Tickless idle.  While the idle thread runs with nothing ready,
+   PIT channel 0 is reprogrammed so that one period spans up to
+   the next ktimer deadline, limited by the 16-bit counter.  The
+   first interrupt afterward catches `ticks' up and restores the
+   periodic rate.  Reprogramming restarts the counter, so each
+   reload carries over the part of the current tick that is still
+   to come; otherwise every idle period would lose a fraction of a
+   tick and `ticks' would drift behind real time. */
+#define PIT_COUNTS_PER_TICK ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+#define MAX_IDLE_TICKS (65536 / PIT_COUNTS_PER_TICK)
+
+/* Don't stretch a tick that ends within this many PIT counts, so
+   that its interrupt cannot slip in while we reprogram. */
+#define IDLE_MIN_COUNTS (PIT_COUNTS_PER_TICK / 16)
+
+static int64_t idle_stretch = 1;  /* Tick boundaries ending the current
+                                     PIT period, 1 if periodic. */
+static bool pit_reload;           /* Restore the periodic count at the
+                                     next timer interrupt? */
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static void wheel_insert (struct ktimer *);
+static void wheel_run (void);
+static int64_t wheel_next_event (int64_t limit);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void
 timer_init (void)
 {
+  int level, slot;
+
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SIZE; slot++)
+      list_init (&wheel[level][slot]);
+  wheel_ticks = 0;
+
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -76,30 +125,35 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
-/* comparator for inserting elemtns in sorted list*/
-static bool
-less_time_cmp(const struct list_elem* a, const struct list_elem* b, void* aux UNUSED){
-  struct thread* t1 = list_entry(a, struct thread, elem);
-  struct thread* t2 = list_entry(b, struct thread, elem);
-  if(t1->time_to_wake_up == t2->time_to_wake_up)
-  {
-    return t1->priority > t2->priority;
-  }
-  return t1->time_to_wake_up < t2->time_to_wake_up;
-}
+/* wakes up thread T_, a ktimer callback used by timer_sleep() */
+static void
+wake_up_thread (void *t_)
+{
+  struct thread *t = t_;
 
+  thread_unblock (t);
+  if (get_priority_of_specific_thread (t) > thread_get_priority ())
+    intr_yield_on_return ();
+}
 
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
 void
 timer_sleep (int64_t ticks)
 {
+  struct ktimer alarm;
   enum intr_level old_level;
+
   ASSERT (intr_get_level () == INTR_ON);
-  thread_current()-> time_to_wake_up = ticks + timer_ticks();
-  list_insert_ordered(&sleeping_threads,&thread_current()->elem, &less_time_cmp, NULL);
-  old_level = intr_disable();
-  thread_block();
+  if (ticks <= 0)
+    return;
+
+  /* Arm the alarm and block atomically, so that the timer
+     interrupt cannot try to wake us before we are blocked. */
+  ktimer_init (&alarm, wake_up_thread, thread_current ());
+  old_level = intr_disable ();
+  ktimer_add (&alarm, timer_ticks () + ticks);
+  thread_block ();
   intr_set_level (old_level);
 }
 
@@ -175,34 +229,269 @@ timer_print_stats (void)
 }
 
 
-/* wakes up thread */
-static void
-wake_up_thread(void){
-  struct thread * t;
-  while(!list_empty(&sleeping_threads) &&  (t = list_entry(list_front(&sleeping_threads), struct thread, elem))->time_to_wake_up <= timer_ticks() && t != NULL){
-    list_pop_front(&sleeping_threads);
-    thread_unblock(t);
-  }
+/* Initializes timer T to call FUNC with AUX when it fires.
+   T is not armed until ktimer_add() is called. */
+void
+ktimer_init (struct ktimer *t, ktimer_func *func, void *aux)
+{
+  ASSERT (t != NULL);
+  ASSERT (func != NULL);
+
+  t->expires = 0;
+  t->func = func;
+  t->aux = aux;
+  t->pending = false;
 }
 
-/* update_priority_of_all_threads */
+/* Arms timer T to fire on the first timer tick at or after
+   EXPIRES, which is an absolute value comparable to
+   timer_ticks().  T must not already be pending.
+
+   This function may be called from an interrupt handler,
+   including from a ktimer callback. */
 void
-update_priority_of_all_threads(void) {
-  for(struct list_elem* iter = list_begin(&all_list);
-      iter != list_end(&all_list);
-      iter = list_next(iter))
-  {
-    struct thread * t = list_entry(iter, struct thread, allelem);
-    mlfqs_set_priority_for_specific_thread(t);
-  }
+ktimer_add (struct ktimer *t, int64_t expires)
+{
+  enum intr_level old_level;
+
+  ASSERT (t != NULL);
+
+  old_level = intr_disable ();
+  ASSERT (!t->pending);
+  t->expires = expires;
+  t->pending = true;
+  wheel_insert (t);
+  intr_set_level (old_level);
+}
+
+/* Disarms timer T.  Returns true if T was pending, false if it
+   had already fired or was never armed.
+
+   This function may be called from an interrupt handler. */
+bool
+ktimer_cancel (struct ktimer *t)
+{
+  enum intr_level old_level;
+  bool was_pending;
+
+  ASSERT (t != NULL);
+
+  old_level = intr_disable ();
+  was_pending = t->pending;
+  if (was_pending)
+    {
+      list_remove (&t->elem);
+      t->pending = false;
+    }
+  intr_set_level (old_level);
+  return was_pending;
+}
+
+/* Called by the idle thread, with interrupts off, when no thread
+   is ready to run.  Stretches the current timer period so that
+   the next timer interrupt arrives at the earliest tick that has
+   work to do: a ktimer deadline or, under the MLFQS scheduler,
+   the next once-per-second load average update.  Does nothing if
+   the period is still stretched from the last time, which then
+   ends within a tick. */
+void
+timer_idle_enter (void)
+{
+  int64_t deadline;
+  int32_t remaining;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (thread_ready_count () == 0);
+
+  deadline = wheel_next_event (MAX_IDLE_TICKS);
+  if (thread_mlfqs)
+    {
+      int64_t second = (ticks / TIMER_FREQ + 1) * TIMER_FREQ;
+      if (second < deadline)
+        deadline = second;
+    }
+  if (deadline - ticks <= 1 || idle_stretch > 1)
+    return;
+
+  /* The first tick of the stretched period is what remains of the
+     current one.  A count of 65536 is loaded as 0. */
+  remaining = pit_read_channel (0);
+  if (remaining < IDLE_MIN_COUNTS)
+    return;
+  idle_stretch = deadline - ticks;
+  pit_load_channel (0, 2, remaining
+                          + (idle_stretch - 1) * PIT_COUNTS_PER_TICK);
+  pit_reload = true;
+}
+
+/* Called by the idle thread after any interrupt wakes it.  If
+   that interrupt was not the timer's, the PIT is still in a
+   stretched period: account for the tick boundaries passed so far
+   and load the rest of the current tick, after which the timer
+   interrupt goes back to periodic mode.  No ktimer can be due
+   yet, since the period ends at the earliest deadline. */
+void
+timer_idle_exit (void)
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (idle_stretch > 1)
+    {
+      int32_t count = pit_read_channel (0);
+      int64_t ahead, elapsed;
+      int32_t rest;
+
+      /* COUNT lies in the tick that ends AHEAD whole ticks before
+         the period does, with REST counts of it still to go.  If
+         that is the period's last tick, let it run out: its
+         interrupt may be about to arrive. */
+      if (count == 0)
+        count = 65536;
+      ahead = (count - 1) / PIT_COUNTS_PER_TICK;
+      rest = count - ahead * PIT_COUNTS_PER_TICK;
+      if (ahead > 0)
+        {
+          elapsed = idle_stretch - 1 - ahead;
+          ticks += elapsed;
+          thread_idle_catch_up (elapsed);
+          idle_stretch = 1;
+
+          /* A count of 1 is illegal in mode 2. */
+          pit_load_channel (0, 2, rest > 1 ? rest : 2);
+        }
+    }
+  intr_set_level (old_level);
+}
+
+/* Returns true if T is armed and has not fired yet. */
+bool
+ktimer_pending (const struct ktimer *t)
+{
+  return t->pending;
+}
+
+/* Puts T into the wheel slot for its expiry tick.  Timers that
+   are already due go into the slot processed next; timers beyond
+   the wheel's span are parked in the outermost level and
+   re-inserted when that slot cascades.
+   Interrupts must be off. */
+static void
+wheel_insert (struct ktimer *t)
+{
+  int64_t expires = t->expires;
+  int64_t delta;
+  int level;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (expires < wheel_ticks)
+    expires = wheel_ticks;
+  else if (expires - wheel_ticks >= WHEEL_SPAN)
+    expires = wheel_ticks + WHEEL_SPAN - 1;
+  delta = expires - wheel_ticks;
+
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (delta < (int64_t) 1 << (WHEEL_BITS * (level + 1)))
+      break;
+  list_push_back (&wheel[level][(expires >> (WHEEL_BITS * level)) & WHEEL_MASK],
+                  &t->elem);
+}
+
+/* Moves every timer in SLOT of LEVEL one level down the wheel.
+   Returns SLOT, so that callers know whether LEVEL wrapped. */
+static int
+wheel_cascade (int level, int slot)
+{
+  struct list moving;
+
+  list_init (&moving);
+  if (!list_empty (&wheel[level][slot]))
+    list_splice (list_end (&moving), list_begin (&wheel[level][slot]),
+                 list_end (&wheel[level][slot]));
+  while (!list_empty (&moving))
+    wheel_insert (list_entry (list_pop_front (&moving), struct ktimer, elem));
+  return slot;
+}
+
+/* Returns the first tick, no later than LIMIT ticks from now,
+   at which the wheel has work to do: a level-0 slot holding a
+   timer, or a level-0 wraparound that may cascade timers down
+   from the higher levels.  Interrupts must be off. */
+static int64_t
+wheel_next_event (int64_t limit)
+{
+  int64_t t;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (t = wheel_ticks; t < ticks + limit; t++)
+    if ((t & WHEEL_MASK) == 0 || !list_empty (&wheel[0][t & WHEEL_MASK]))
+      return t;
+  return ticks + limit;
+}
+
+/* Fires every timer due at or before the current tick.  Runs in
+   the timer interrupt, once per elapsed tick.  Timers are
+   detached from their slot before their callbacks run, so a
+   callback may safely re-arm its own timer. */
+static void
+wheel_run (void)
+{
+  while (wheel_ticks <= ticks)
+    {
+      int64_t now = wheel_ticks;
+      int slot = now & WHEEL_MASK;
+      struct list due;
+      int level;
+
+      /* Cascade each level whose lower neighbor just wrapped. */
+      for (level = 1; slot == 0 && level < WHEEL_LEVELS; level++)
+        slot = wheel_cascade (level,
+                              (now >> (WHEEL_BITS * level)) & WHEEL_MASK);
+
+      list_init (&due);
+      slot = now & WHEEL_MASK;
+      if (!list_empty (&wheel[0][slot]))
+        list_splice (list_end (&due), list_begin (&wheel[0][slot]),
+                     list_end (&wheel[0][slot]));
+      wheel_ticks++;
+
+      while (!list_empty (&due))
+        {
+          struct ktimer *t = list_entry (list_pop_front (&due),
+                                         struct ktimer, elem);
+          if (t->expires > now)
+            {
+              /* Parked beyond the wheel's span; not due yet. */
+              wheel_insert (t);
+              continue;
+            }
+          t->pending = false;
+          t->func (t->aux);
+        }
+    }
 }
 
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
+  if (idle_stretch > 1)
+    {
+      /* End of a tickless idle period: the PIT skipped
+         IDLE_STRETCH - 1 interrupts, all spent idle. */
+      ticks += idle_stretch - 1;
+      thread_idle_catch_up (idle_stretch - 1);
+      idle_stretch = 1;
+    }
+  if (pit_reload)
+    {
+      /* End of a stretched or partial period. */
+      pit_reload = false;
+      pit_load_channel (0, 2, PIT_COUNTS_PER_TICK);
+    }
   ticks++;
-  wake_up_thread();
+  wheel_run ();
   thread_tick ();
 }
 
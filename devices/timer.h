@@ -15,6 +15,23 @@
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
+/* Kernel timer callback.  Runs in the timer interrupt handler,
+   so it must not sleep. */
+typedef void ktimer_func (void *aux);
+
+/* A one-shot kernel timer.  Once armed with ktimer_add(), FUNC
+   is called with AUX from the timer interrupt on the first tick
+   at or after EXPIRES.  The owner must keep the structure alive
+   until it fires or is cancelled. */
+struct ktimer
+  {
+    struct list_elem elem;      /* Element in a timer wheel slot. */
+    int64_t expires;            /* Tick at which to fire. */
+    ktimer_func *func;          /* Callback. */
+    void *aux;                  /* Passed to FUNC. */
+    bool pending;               /* Armed and not yet fired? */
+  };
+
 void timer_init (void);
 void timer_calibrate (void);
 
@@ -34,5 +51,13 @@ void timer_ndelay (int64_t nanoseconds);
 
 void timer_print_stats (void);
 
-void update_priority_of_all_threads(void);
+/* Tickless idle, used by the idle thread. */
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
+/* Generic kernel timers. */
+void ktimer_init (struct ktimer *, ktimer_func *, void *aux);
+void ktimer_add (struct ktimer *, int64_t expires);
+bool ktimer_cancel (struct ktimer *);
+bool ktimer_pending (const struct ktimer *);
 #endif /* devices/timer.h */
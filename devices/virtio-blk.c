@@ -0,0 +1,429 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The code in this file drives virtio block devices, the
+   paravirtualized disks offered by QEMU, KVM and other virtual
+   machine monitors, through the "legacy" PCI interface of
+   version 0.9.5 of the virtio specification.
+
+   Unlike an IDE disk, a virtio disk accepts many requests at
+   once.  Each request is a chain of descriptors in a ring shared
+   with the device (a "virtqueue"): a header naming the operation
+   and sector, one descriptor per data segment, and a status byte
+   the device fills in.  The device takes requests off the
+   "available" ring, performs them in whatever order it likes,
+   and puts them on the "used" ring, raising an interrupt.  So
+   this driver takes requests from the block layer through its
+   SUBMIT operation and completes them from its interrupt
+   handler, bypassing the block layer's queue. */
+
+/* PCI IDs of a legacy virtio block device. */
+#define VIRTIO_VENDOR_ID 0x1af4
+#define VIRTIO_BLK_DEVICE_ID 0x1001
+
+/* Legacy virtio registers, as offsets from the I/O port base in
+   PCI BAR 0. */
+#define reg_host_features(D) ((D)->io_base + 0x00)   /* 32 bits (r/o). */
+#define reg_guest_features(D) ((D)->io_base + 0x04)  /* 32 bits. */
+#define reg_queue_pfn(D) ((D)->io_base + 0x08)       /* 32 bits. */
+#define reg_queue_size(D) ((D)->io_base + 0x0c)      /* 16 bits (r/o). */
+#define reg_queue_select(D) ((D)->io_base + 0x0e)    /* 16 bits. */
+#define reg_queue_notify(D) ((D)->io_base + 0x10)    /* 16 bits. */
+#define reg_status(D) ((D)->io_base + 0x12)          /* 8 bits. */
+#define reg_isr(D) ((D)->io_base + 0x13)             /* 8 bits (r/o). */
+#define reg_capacity(D) ((D)->io_base + 0x14)        /* 64 bits (r/o). */
+
+/* Device status register bits. */
+#define STATUS_ACKNOWLEDGE 0x01 /* Guest has noticed the device. */
+#define STATUS_DRIVER 0x02      /* Guest knows how to drive it. */
+#define STATUS_DRIVER_OK 0x04   /* Driver is ready. */
+#define STATUS_FAILED 0x80      /* Guest has given up on it. */
+
+/* Virtqueue descriptor. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address of buffer. */
+    uint32_t len;               /* Length of buffer in bytes. */
+    uint16_t flags;             /* VRING_DESC_F_* bits. */
+    uint16_t next;              /* Next descriptor, if VRING_DESC_F_NEXT. */
+  };
+
+#define VRING_DESC_F_NEXT 1     /* Chain continues in NEXT. */
+#define VRING_DESC_F_WRITE 2    /* Device writes, rather than reads, it. */
+
+/* Ring of descriptor chains offered to the device. */
+struct vring_avail
+  {
+    uint16_t flags;             /* Unused. */
+    uint16_t idx;               /* Where the driver puts the next entry. */
+    uint16_t ring[];            /* Heads of descriptor chains. */
+  };
+
+/* An entry in the used ring. */
+struct vring_used_elem
+  {
+    uint32_t id;                /* Head of the finished chain. */
+    uint32_t len;               /* Bytes the device wrote. */
+  };
+
+/* Ring of descriptor chains the device has finished with. */
+struct vring_used
+  {
+    uint16_t flags;             /* VRING_USED_F_NO_NOTIFY. */
+    uint16_t idx;               /* Where the device puts the next entry. */
+    struct vring_used_elem ring[];
+  };
+
+/* Set in the used ring's flags while the device is already
+   polling the available ring, making a notification pointless. */
+#define VRING_USED_F_NO_NOTIFY 1
+
+/* Request header, the first descriptor in each chain. */
+struct virtio_blk_header
+  {
+    uint32_t type;              /* VIRTIO_BLK_T_*. */
+    uint32_t reserved;          /* Must be zero. */
+    uint64_t sector;            /* First sector to transfer. */
+  };
+
+#define VIRTIO_BLK_T_IN 0       /* Read. */
+#define VIRTIO_BLK_T_OUT 1      /* Write. */
+#define VIRTIO_BLK_S_OK 0       /* Request succeeded. */
+
+/* Descriptors per request: header, data segments, status. */
+#define SLOT_DESCS (BLOCK_SEG_MAX + 2)
+
+/* State of one request slot.  Slot I owns the SLOT_DESCS
+   descriptors starting at SLOT_DESCS * I.  Slots live in a page
+   of their own, because the device reads HEADER and writes
+   STATUS. */
+struct request_slot
+  {
+    struct virtio_blk_header header;    /* Read by device. */
+    uint8_t status;                     /* Written by device. */
+    int next_free;                      /* Next free slot, or -1. */
+    struct block_request *request;      /* Request in this slot. */
+  };
+
+/* A virtio disk. */
+struct virtio_disk
+  {
+    char name[8];               /* Name, e.g. "vda". */
+    uint16_t io_base;           /* Base I/O port. */
+    uint8_t irq;                /* Interrupt vector, or 0 if none. */
+
+    uint16_t queue_size;        /* Number of descriptors in the queue. */
+    struct vring_desc *desc;    /* Descriptor table. */
+    struct vring_avail *avail;  /* Available ring. */
+    struct vring_used *used;    /* Used ring. */
+    uint16_t last_used;         /* Used ring index we have reached. */
+    uint16_t notified;          /* Available ring index at last notify. */
+
+    struct request_slot *slots; /* Request slots. */
+    int free_slot;              /* First free slot, or -1. */
+    int in_flight;              /* Number of slots in use. */
+    struct semaphore slots_free;        /* Counts free slots. */
+  };
+
+/* Number of virtio disks we support, named "vda", "vdb", .... */
+#define DISK_MAX 4
+static struct virtio_disk disks[DISK_MAX];
+static size_t disk_cnt;
+
+/* Interrupt vectors for which interrupt_handler is registered. */
+static uint16_t irqs_registered;
+
+static struct block_operations virtio_blk_operations;
+
+static pci_scan_func probe;
+static bool init_queue (struct virtio_disk *);
+static void notify (struct virtio_disk *);
+static void interrupt_handler (struct intr_frame *);
+
+/* Finds and registers every virtio block device on the PCI
+   buses, up to DISK_MAX of them. */
+void
+virtio_blk_init (void)
+{
+  pci_scan (probe, NULL);
+}
+
+/* pci_scan() callback.  If A is a virtio block device, brings it
+   up and registers it.  Returns true to end the scan once we
+   cannot take any more disks. */
+static bool
+probe (const struct pci_addr *a, uint32_t id, void *aux UNUSED)
+{
+  struct virtio_disk *d;
+  struct block *block;
+  uint32_t capacity_hi;
+  block_sector_t capacity;
+  int irq;
+
+  if ((id & 0xffff) != VIRTIO_VENDOR_ID
+      || (id >> 16) != VIRTIO_BLK_DEVICE_ID)
+    return false;
+
+  d = &disks[disk_cnt];
+  snprintf (d->name, sizeof d->name, "vd%c", 'a' + (int) disk_cnt);
+  d->io_base = pci_io_bar (a, 0);
+  irq = pci_irq (a);
+  if (d->io_base == 0 || irq < 0)
+    {
+      printf ("%s: no I/O ports or interrupt line, ignoring\n", d->name);
+      return false;
+    }
+  d->irq = irq + 0x20;
+  pci_enable_bus_master (a);
+
+  /* Reset the device, then tell it we know how to drive it.  We
+     accept none of its optional features. */
+  outb (reg_status (d), 0);
+  outb (reg_status (d), STATUS_ACKNOWLEDGE);
+  outb (reg_status (d), STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  inl (reg_host_features (d));
+  outl (reg_guest_features (d), 0);
+
+  if (!init_queue (d))
+    {
+      printf ("%s: could not set up request queue, ignoring\n", d->name);
+      outb (reg_status (d), STATUS_FAILED);
+      return false;
+    }
+
+  /* Devices sharing an interrupt line share one handler, which
+     polls them all. */
+  if (!(irqs_registered & (1 << irq)))
+    {
+      irqs_registered |= 1 << irq;
+      intr_register_ext (d->irq, interrupt_handler, "virtio-blk");
+    }
+  outb (reg_status (d),
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+
+  /* Capacity is 64 bits; clamp what we cannot address. */
+  capacity = inl (reg_capacity (d));
+  capacity_hi = inl (reg_capacity (d) + 4);
+  if (capacity_hi != 0)
+    capacity = (block_sector_t) -1;
+
+  disk_cnt++;
+  block = block_register (d->name, BLOCK_RAW, "virtio", capacity,
+                          &virtio_blk_operations, d);
+  partition_scan (block);
+  return disk_cnt >= DISK_MAX;
+}
+
+/* Allocates D's virtqueue and request slots and hands the queue
+   to the device.  Returns true if successful, false on
+   failure. */
+static bool
+init_queue (struct virtio_disk *d)
+{
+  size_t avail_size, used_size, used_ofs, page_cnt;
+  uint8_t *ring;
+  int i, slot_cnt;
+
+  outw (reg_queue_select (d), 0);
+  d->queue_size = inw (reg_queue_size (d));
+  if (d->queue_size < SLOT_DESCS)
+    return false;
+
+  /* The legacy layout puts the descriptor table and available
+     ring at the start of a page-aligned region and the used ring
+     at the next page boundary after them.  Each ring has a
+     trailing 16-bit event index that we do not use. */
+  avail_size = sizeof (struct vring_avail)
+               + (d->queue_size + 1) * sizeof (uint16_t);
+  used_size = sizeof (struct vring_used)
+              + d->queue_size * sizeof (struct vring_used_elem)
+              + sizeof (uint16_t);
+  used_ofs = ROUND_UP (d->queue_size * sizeof (struct vring_desc)
+                       + avail_size, PGSIZE);
+  page_cnt = DIV_ROUND_UP (used_ofs + used_size, PGSIZE);
+
+  ring = palloc_get_multiple (PAL_ZERO, page_cnt);
+  if (ring == NULL)
+    return false;
+  d->slots = palloc_get_page (PAL_ZERO);
+  if (d->slots == NULL)
+    {
+      palloc_free_multiple (ring, page_cnt);
+      return false;
+    }
+  d->desc = (struct vring_desc *) ring;
+  d->avail = (struct vring_avail *) (ring
+                                     + d->queue_size
+                                       * sizeof (struct vring_desc));
+  d->used = (struct vring_used *) (ring + used_ofs);
+  d->last_used = 0;
+  d->notified = 0;
+
+  /* Each slot's header descriptor never changes, so set it up
+     once, here. */
+  slot_cnt = d->queue_size / SLOT_DESCS;
+  if ((size_t) slot_cnt > PGSIZE / sizeof *d->slots)
+    slot_cnt = PGSIZE / sizeof *d->slots;
+  for (i = 0; i < slot_cnt; i++)
+    {
+      struct request_slot *s = &d->slots[i];
+      struct vring_desc *desc = &d->desc[SLOT_DESCS * i];
+
+      desc->addr = vtop (&s->header);
+      desc->len = sizeof s->header;
+      desc->flags = VRING_DESC_F_NEXT;
+      desc->next = SLOT_DESCS * i + 1;
+
+      s->next_free = i + 1 < slot_cnt ? i + 1 : -1;
+    }
+  d->free_slot = 0;
+  d->in_flight = 0;
+  sema_init (&d->slots_free, slot_cnt);
+
+  /* Physical page frame number of the queue. */
+  outl (reg_queue_pfn (d), vtop (ring) >> PGBITS);
+  return true;
+}
+
+/* Starts request R on disk D_.  Waits only if every request slot
+   is in use.
+
+   Notifications are batched: the device is notified right away
+   only if it was idle.  Otherwise it will finish a request
+   before long, and the interrupt handler notifies it of
+   everything queued up in the meantime at once. */
+static void
+virtio_blk_submit (void *d_, struct block_request *r)
+{
+  struct virtio_disk *d = d_;
+  struct request_slot *s;
+  struct vring_desc *desc;
+  enum intr_level old_level;
+  size_t i;
+  int slot;
+
+  sema_down (&d->slots_free);
+  old_level = intr_disable ();
+  slot = d->free_slot;
+  ASSERT (slot >= 0);
+  s = &d->slots[slot];
+  d->free_slot = s->next_free;
+  intr_set_level (old_level);
+
+  s->header.type = r->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  s->header.reserved = 0;
+  s->header.sector = r->sector;
+  s->status = 0xff;
+  s->request = r;
+
+  /* One descriptor per segment, then the status byte.  Each
+     segment is physically contiguous. */
+  desc = &d->desc[SLOT_DESCS * slot + 1];
+  for (i = 0; i < r->seg_cnt; i++, desc++)
+    {
+      desc->addr = vtop (r->segs[i].buffer);
+      desc->len = r->segs[i].cnt * BLOCK_SECTOR_SIZE;
+      desc->flags = VRING_DESC_F_NEXT | (r->write ? 0 : VRING_DESC_F_WRITE);
+      desc->next = desc - d->desc + 1;
+    }
+  desc->addr = vtop (&s->status);
+  desc->len = sizeof s->status;
+  desc->flags = VRING_DESC_F_WRITE;
+
+  old_level = intr_disable ();
+  d->avail->ring[d->avail->idx % d->queue_size] = SLOT_DESCS * slot;
+  barrier ();
+  d->avail->idx++;
+  if (d->in_flight++ == 0)
+    notify (d);
+  intr_set_level (old_level);
+}
+
+/* Notifies D of requests added to its available ring since the
+   last notification, unless it has said it needs none. */
+static void
+notify (struct virtio_disk *d)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  barrier ();
+  if (d->notified == d->avail->idx)
+    return;
+  d->notified = d->avail->idx;
+  if (!(d->used->flags & VRING_USED_F_NO_NOTIFY))
+    outw (reg_queue_notify (d), 0);
+}
+
+/* Completes each request that D has finished with. */
+static void
+complete_requests (struct virtio_disk *d)
+{
+  for (;;)
+    {
+      struct request_slot *s;
+      struct block_request *r;
+      int slot;
+
+      barrier ();
+      if (d->last_used == d->used->idx)
+        break;
+      slot = d->used->ring[d->last_used % d->queue_size].id / SLOT_DESCS;
+      d->last_used++;
+
+      s = &d->slots[slot];
+      r = s->request;
+      if (s->status != VIRTIO_BLK_S_OK)
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu", status=%d",
+               d->name, r->write ? "write" : "read", r->sector, s->status);
+      s->request = NULL;
+      s->next_free = d->free_slot;
+      d->free_slot = slot;
+      d->in_flight--;
+      sema_up (&d->slots_free);
+      block_complete (r);
+    }
+}
+
+static struct block_operations virtio_blk_operations =
+  {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    virtio_blk_submit
+  };
+
+/* virtio interrupt handler.  Reading the ISR register
+   acknowledges the interrupt, so we read it before looking at
+   the used ring: a request finishing after that raises a fresh
+   interrupt. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  size_t i;
+
+  for (i = 0; i < disk_cnt; i++)
+    {
+      struct virtio_disk *d = &disks[i];
+      if (d->irq != f->vec_no)
+        continue;
+
+      inb (reg_isr (d));
+      complete_requests (d);
+      notify (d);
+    }
+}
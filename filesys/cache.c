@@ -0,0 +1,652 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* A cached sector.
+
+   The tag fields (BLOCK, SECTOR, IN_USE), ACCESSED and PIN_CNT
+   are protected by cache_lock.  DATA and DIRTY are protected by
+   RWLOCK, which may only be acquired by a thread that has the
+   entry pinned.  Writing an entry back takes RWLOCK for writing,
+   so that exactly one thread clears DIRTY and writes the sector,
+   and anyone else wanting it clean waits until the write is
+   done. */
+struct cache_entry
+  {
+    struct hash_elem hash_elem;         /* Element in cache_index. */
+    struct block *block;                /* Device of cached sector. */
+    block_sector_t sector;              /* Cached sector number. */
+    bool in_use;                        /* Holds a sector? */
+    bool accessed;                      /* Used since the clock hand passed? */
+    int pin_cnt;                        /* Threads using this entry. */
+    bool dirty;                         /* Modified since read or written back? */
+    struct rwlock rwlock;               /* Guards DATA and DIRTY. */
+    uint8_t *data;                      /* BLOCK_SECTOR_SIZE bytes. */
+  };
+
+size_t cache_size = CACHE_SIZE_DEFAULT;
+
+static struct cache_entry *cache;       /* Array of CACHE_SIZE entries. */
+static struct hash cache_index;         /* Entries in use, by (block, sector). */
+static size_t clock_hand;               /* Next eviction candidate. */
+static struct lock cache_lock;          /* Guards the index and tags. */
+static struct condition cache_unpinned; /* Signaled when an entry is unpinned. */
+
+/* Most write-backs cache_flush() has outstanding at once. */
+#define FLUSH_BATCH 16
+
+/* Write-behind.  DIRTY_CNT and FLUSH_KICKED are only accessed
+   with interrupts off, since the flush timer runs in interrupt
+   context. */
+static size_t dirty_cnt;                /* Number of dirty entries. */
+static bool flush_kicked;               /* FLUSH_REQUEST already up'd? */
+static struct semaphore flush_request;  /* Wakes the flusher thread. */
+static struct ktimer flush_timer;       /* Periodic flusher wakeup. */
+
+/* Read-ahead requests, a ring of sectors waiting for the
+   read-ahead thread.  Requests that do not fit are dropped.
+   Runs of up to RA_BATCH consecutive sectors are read with a
+   single device request. */
+#define RA_QUEUE_LEN 32
+#define RA_BATCH 8
+struct ra_request
+  {
+    struct block *block;
+    block_sector_t sector;
+  };
+static struct ra_request ra_queue[RA_QUEUE_LEN];
+static size_t ra_head, ra_cnt;          /* First request, number queued. */
+static struct lock ra_lock;             /* Guards RA_QUEUE. */
+static struct semaphore ra_ready;       /* Counts queued requests. */
+
+static hash_hash_func cache_hash;
+static hash_less_func cache_less;
+static thread_func cache_flusher NO_RETURN;
+static thread_func cache_reader NO_RETURN;
+static ktimer_func flush_timer_expired;
+
+/* Initializes the buffer cache. */
+void
+cache_init (void)
+{
+  uint8_t *data;
+  size_t i;
+
+  ASSERT (cache_size > 0);
+  cache = calloc (cache_size, sizeof *cache);
+  data = malloc (cache_size * BLOCK_SECTOR_SIZE);
+  if (cache == NULL || data == NULL
+      || !hash_init (&cache_index, cache_hash, cache_less, NULL))
+    PANIC ("buffer cache allocation failed");
+
+  for (i = 0; i < cache_size; i++)
+    {
+      rwlock_init (&cache[i].rwlock);
+      cache[i].data = data + i * BLOCK_SECTOR_SIZE;
+    }
+  clock_hand = 0;
+  lock_init (&cache_lock);
+  cond_init (&cache_unpinned);
+
+  dirty_cnt = 0;
+  flush_kicked = false;
+  sema_init (&flush_request, 0);
+  ktimer_init (&flush_timer, flush_timer_expired, NULL);
+  thread_create ("flusher", PRI_DEFAULT, cache_flusher, NULL);
+
+  ra_head = ra_cnt = 0;
+  lock_init (&ra_lock);
+  sema_init (&ra_ready, 0);
+  thread_create ("read-ahead", PRI_DEFAULT, cache_reader, NULL);
+}
+
+/* Wakes the flusher thread, unless it is already due to run.
+   Interrupts must be off. */
+static void
+kick_flusher (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  if (!flush_kicked)
+    {
+      flush_kicked = true;
+      sema_up (&flush_request);
+    }
+}
+
+/* Timer callback for the flusher's periodic wakeup. */
+static void
+flush_timer_expired (void *aux UNUSED)
+{
+  kick_flusher ();
+}
+
+/* Adjusts the dirty entry count by DELTA.  Once more than half
+   the cache is dirty, the flusher is woken early so that
+   eviction keeps finding clean victims. */
+static void
+count_dirty (int delta)
+{
+  enum intr_level old_level = intr_disable ();
+  dirty_cnt += delta;
+  if (dirty_cnt > cache_size / 2)
+    kick_flusher ();
+  intr_set_level (old_level);
+}
+
+/* Write-behind thread.  Flushes the cache every
+   CACHE_FLUSH_INTERVAL ticks, or sooner when kicked. */
+static void
+cache_flusher (void *aux UNUSED)
+{
+  for (;;)
+    {
+      enum intr_level old_level;
+
+      ktimer_add (&flush_timer, timer_ticks () + CACHE_FLUSH_INTERVAL);
+      sema_down (&flush_request);
+      ktimer_cancel (&flush_timer);
+
+      old_level = intr_disable ();
+      flush_kicked = false;
+      intr_set_level (old_level);
+
+      cache_flush ();
+    }
+}
+
+/* Returns the in-use entry for SECTOR on BLOCK, or a null pointer
+   if there is none.  cache_lock must be held. */
+static struct cache_entry *
+cache_lookup (struct block *block, block_sector_t sector)
+{
+  struct cache_entry key;
+  struct hash_elem *e;
+
+  key.block = block;
+  key.sector = sector;
+  e = hash_find (&cache_index, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct cache_entry, hash_elem) : NULL;
+}
+
+/* Writes E's data back to its sector if it is dirty, returning
+   once any write-back of E in progress is complete.  E must be
+   pinned, and cache_lock must not be held. */
+static void
+cache_writeback (struct cache_entry *e)
+{
+  rwlock_acquire_write (&e->rwlock);
+  if (e->dirty)
+    {
+      e->dirty = false;
+      count_dirty (-1);
+      block_write (e->block, e->sector, e->data);
+    }
+  rwlock_release_write (&e->rwlock);
+}
+
+/* Drops a pin on E. */
+static void
+cache_unpin (struct cache_entry *e)
+{
+  lock_acquire (&cache_lock);
+  ASSERT (e->pin_cnt > 0);
+  if (--e->pin_cnt == 0)
+    cond_broadcast (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Runs the clock hand until it finds an unpinned entry that is
+   clean and not recently used, and returns it.  Dirty candidates
+   are written back along the way.  If every entry is pinned,
+   waits for one to be unpinned if WAIT is true, and otherwise
+   returns a null pointer.  cache_lock must be held; it is
+   released and reacquired while waiting and writing back. */
+static struct cache_entry *
+cache_evict (bool wait)
+{
+  size_t pinned = 0;
+
+  for (;;)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % cache_size;
+
+      if (e->pin_cnt > 0)
+        {
+          /* Wait if a full sweep found everything in use. */
+          if (++pinned >= cache_size)
+            {
+              if (!wait)
+                return NULL;
+              cond_wait (&cache_unpinned, &cache_lock);
+              pinned = 0;
+            }
+          continue;
+        }
+      pinned = 0;
+
+      if (!e->in_use)
+        return e;
+      if (e->accessed)
+        {
+          e->accessed = false;
+          continue;
+        }
+      if (e->dirty)
+        {
+          /* Clean it without holding up other cache users.  It
+             stays findable meanwhile, so lookups of its sector
+             still see the current data.  Having to do this at
+             all means the flusher is behind, so wake it too. */
+          enum intr_level old_level = intr_disable ();
+          kick_flusher ();
+          intr_set_level (old_level);
+
+          e->pin_cnt++;
+          lock_release (&cache_lock);
+          cache_writeback (e);
+          cache_unpin (e);
+          lock_acquire (&cache_lock);
+          continue;
+        }
+
+      hash_delete (&cache_index, &e->hash_elem);
+      e->in_use = false;
+      return e;
+    }
+}
+
+/* Returns the entry for SECTOR on BLOCK, pinned.  If SECTOR was
+   not cached, claims a free entry for it, sets *CLAIMED to true,
+   and returns the entry with its lock held for writing; the
+   caller must fill in its data and then release the lock.
+   Threads that find the entry meanwhile wait on the lock.
+   If claiming an entry would mean waiting for one to be unpinned
+   and WAIT is false, returns a null pointer instead. */
+static struct cache_entry *
+cache_claim (struct block *block, block_sector_t sector, bool wait,
+             bool *claimed)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = cache_lookup (block, sector);
+  if (e == NULL)
+    {
+      struct cache_entry *victim = cache_evict (wait);
+
+      if (victim == NULL)
+        {
+          lock_release (&cache_lock);
+          return NULL;
+        }
+
+      /* Another thread may have loaded the sector while we were
+         evicting. */
+      e = cache_lookup (block, sector);
+      if (e == NULL)
+        {
+          e = victim;
+          /* No other thread holds E's lock, because E was
+             unpinned, so taking it here cannot block. */
+          e->block = block;
+          e->sector = sector;
+          e->in_use = true;
+          e->accessed = true;
+          e->pin_cnt = 1;
+          e->dirty = false;
+          hash_insert (&cache_index, &e->hash_elem);
+          rwlock_acquire_write (&e->rwlock);
+          lock_release (&cache_lock);
+
+          block_account_cache (block, false);
+          *claimed = true;
+          return e;
+        }
+    }
+
+  e->pin_cnt++;
+  e->accessed = true;
+  lock_release (&cache_lock);
+  block_account_cache (block, true);
+  *claimed = false;
+  return e;
+}
+
+/* Returns the entry for SECTOR on BLOCK, pinned, loading it into
+   the cache if necessary.  If FILL is non-null, it holds a full
+   sector that the caller is about to write, so a newly loaded
+   entry is initialized from it instead of being read from
+   disk. */
+static struct cache_entry *
+cache_get (struct block *block, block_sector_t sector, const void *fill)
+{
+  bool claimed;
+  struct cache_entry *e = cache_claim (block, sector, true, &claimed);
+
+  if (claimed)
+    {
+      if (fill != NULL)
+        {
+          memcpy (e->data, fill, BLOCK_SECTOR_SIZE);
+          e->dirty = true;
+          count_dirty (1);
+        }
+      else
+        block_read (block, sector, e->data);
+      rwlock_release_write (&e->rwlock);
+    }
+  return e;
+}
+
+/* Reads sector SECTOR from BLOCK into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes, through the cache. */
+void
+cache_read (struct block *block, block_sector_t sector, void *buffer)
+{
+  cache_read_at (block, sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at byte offset OFS within sector
+   SECTOR of BLOCK into BUFFER, through the cache. */
+void
+cache_read_at (struct block *block, block_sector_t sector, void *buffer,
+               int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (block, sector, NULL);
+  rwlock_acquire_read (&e->rwlock);
+  memcpy (buffer, e->data + ofs, size);
+  rwlock_release_read (&e->rwlock);
+  cache_unpin (e);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to sector SECTOR of
+   BLOCK, through the cache.  The data reaches the disk when the
+   entry is evicted or flushed. */
+void
+cache_write (struct block *block, block_sector_t sector, const void *buffer)
+{
+  cache_write_at (block, sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER to byte offset OFS within sector
+   SECTOR of BLOCK, through the cache. */
+void
+cache_write_at (struct block *block, block_sector_t sector,
+                const void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (block, sector, size == BLOCK_SECTOR_SIZE ? buffer : NULL);
+  rwlock_acquire_write (&e->rwlock);
+  memcpy (e->data + ofs, buffer, size);
+  if (!e->dirty)
+    {
+      e->dirty = true;
+      count_dirty (1);
+    }
+  rwlock_release_write (&e->rwlock);
+  cache_unpin (e);
+}
+
+/* Writes every dirty entry back to disk.  Write-backs are
+   submitted up to FLUSH_BATCH at a time, and to a quarter of the
+   cache, so the device queue can sort and merge them.  Each
+   entry's lock is held for writing until its write completes.
+   While a batch holds entry locks, a busy entry ends the batch
+   instead of being waited for, and is retried once the batch is
+   done; so a flush never blocks on a lock while holding others,
+   and cannot deadlock with other flushes or the read-ahead
+   thread. */
+void
+cache_flush (void)
+{
+  struct cache_entry *batch[FLUSH_BATCH];
+  struct block_request requests[FLUSH_BATCH];
+  size_t max = cache_size / 4 < FLUSH_BATCH ? cache_size / 4 : FLUSH_BATCH;
+  size_t i = 0;
+
+  if (max == 0)
+    max = 1;
+  while (i < cache_size)
+    {
+      size_t cnt = 0;
+      size_t j;
+
+      for (; i < cache_size && cnt < max; i++)
+        {
+          struct cache_entry *e = &cache[i];
+
+          lock_acquire (&cache_lock);
+          if (!e->in_use)
+            {
+              lock_release (&cache_lock);
+              continue;
+            }
+          e->pin_cnt++;
+          lock_release (&cache_lock);
+
+          if (cnt == 0)
+            rwlock_acquire_write (&e->rwlock);
+          else if (!rwlock_try_acquire_write (&e->rwlock))
+            {
+              cache_unpin (e);
+              break;
+            }
+          if (!e->dirty)
+            {
+              rwlock_release_write (&e->rwlock);
+              cache_unpin (e);
+              continue;
+            }
+          e->dirty = false;
+          count_dirty (-1);
+          block_request_init (&requests[cnt], true, e->sector, 1, e->data,
+                              NULL, NULL);
+          block_submit (e->block, &requests[cnt]);
+          batch[cnt++] = e;
+        }
+
+      for (j = 0; j < cnt; j++)
+        {
+          struct cache_entry *e = batch[j];
+
+          block_wait (&requests[j]);
+          rwlock_release_write (&e->rwlock);
+          cache_unpin (e);
+        }
+    }
+}
+
+/* Writes sector SECTOR of BLOCK back to disk if it is cached and
+   dirty, and returns once the write is complete. */
+void
+cache_flush_sector (struct block *block, block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = cache_lookup (block, sector);
+  if (e != NULL)
+    e->pin_cnt++;
+  lock_release (&cache_lock);
+
+  if (e != NULL)
+    {
+      cache_writeback (e);
+      cache_unpin (e);
+    }
+}
+
+/* Returns true if sector SECTOR of BLOCK is in the cache, in
+   which case the cached copy, not the disk, holds its current
+   contents.  A sector that is not cached is current on disk until
+   someone writes it through the cache. */
+bool
+cache_contains (struct block *block, block_sector_t sector)
+{
+  bool cached;
+
+  lock_acquire (&cache_lock);
+  cached = cache_lookup (block, sector) != NULL;
+  lock_release (&cache_lock);
+  return cached;
+}
+
+/* Drops any cached copy of sector SECTOR of BLOCK without writing
+   it back, first waiting for threads using it, such as the
+   read-ahead thread loading it, to finish.  For use after writing
+   SECTOR directly to disk, bypassing the cache, so that a copy
+   loaded in the meantime cannot hide the new data. */
+void
+cache_discard (struct block *block, block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  while ((e = cache_lookup (block, sector)) != NULL && e->pin_cnt > 0)
+    cond_wait (&cache_unpinned, &cache_lock);
+  if (e != NULL)
+    {
+      hash_delete (&cache_index, &e->hash_elem);
+      e->in_use = false;
+      if (e->dirty)
+        {
+          e->dirty = false;
+          count_dirty (-1);
+        }
+    }
+  lock_release (&cache_lock);
+}
+
+/* Asks the read-ahead thread to bring sector SECTOR of BLOCK into
+   the cache, and returns without waiting.  Does nothing if the
+   sector is already cached or too many requests are pending. */
+void
+cache_readahead (struct block *block, block_sector_t sector)
+{
+  if (cache_contains (block, sector))
+    return;
+
+  lock_acquire (&ra_lock);
+  if (ra_cnt < RA_QUEUE_LEN)
+    {
+      struct ra_request *r = &ra_queue[(ra_head + ra_cnt++) % RA_QUEUE_LEN];
+      r->block = block;
+      r->sector = sector;
+      sema_up (&ra_ready);
+    }
+  lock_release (&ra_lock);
+}
+
+/* Removes and returns the first queued read-ahead request.
+   RA_LOCK must be held and the queue must not be empty. */
+static struct ra_request
+ra_dequeue (void)
+{
+  struct ra_request r = ra_queue[ra_head];
+
+  ASSERT (ra_cnt > 0);
+  ra_head = (ra_head + 1) % RA_QUEUE_LEN;
+  ra_cnt--;
+  return r;
+}
+
+/* Read-ahead thread.  Loads queued sectors into the cache,
+   merging runs of consecutive sectors into one device read. */
+static void
+cache_reader (void *aux UNUSED)
+{
+  static uint8_t buffer[RA_BATCH * BLOCK_SECTOR_SIZE];
+  struct cache_entry *entries[RA_BATCH];
+  bool claimed[RA_BATCH];
+
+  /* Never pin more than half the cache at once, and stop short
+     of that if other threads have the rest pinned. */
+  size_t batch = cache_size / 2 < RA_BATCH ? cache_size / 2 : RA_BATCH;
+  if (batch == 0)
+    batch = 1;
+
+  for (;;)
+    {
+      struct ra_request r;
+      block_sector_t cnt, i;
+      bool any_claimed = false;
+
+      sema_down (&ra_ready);
+      lock_acquire (&ra_lock);
+      r = ra_dequeue ();
+      for (cnt = 1; cnt < batch && ra_cnt > 0; cnt++)
+        {
+          struct ra_request *next = &ra_queue[ra_head];
+          if (next->block != r.block || next->sector != r.sector + cnt
+              || !sema_try_down (&ra_ready))
+            break;
+          ra_dequeue ();
+        }
+      lock_release (&ra_lock);
+
+      /* Only the first claim may wait for an entry to be
+         unpinned: later ones would wait while holding the entries
+         claimed so far locked, which could deadlock with a
+         flush.  The sectors not claimed are dropped. */
+      for (i = 0; i < cnt; i++)
+        {
+          entries[i] = cache_claim (r.block, r.sector + i, i == 0,
+                                    &claimed[i]);
+          if (entries[i] == NULL)
+            {
+              cnt = i;
+              break;
+            }
+          any_claimed |= claimed[i];
+        }
+      if (any_claimed)
+        block_read_range (r.block, r.sector, cnt, buffer);
+      for (i = 0; i < cnt; i++)
+        {
+          if (claimed[i])
+            {
+              memcpy (entries[i]->data, buffer + i * BLOCK_SECTOR_SIZE,
+                      BLOCK_SECTOR_SIZE);
+              rwlock_release_write (&entries[i]->rwlock);
+            }
+          cache_unpin (entries[i]);
+        }
+    }
+}
+
+/* Hashes an entry by its (block, sector) tag. */
+static unsigned
+cache_hash (const struct hash_elem *e_, void *aux UNUSED)
+{
+  const struct cache_entry *e = hash_entry (e_, struct cache_entry,
+                                            hash_elem);
+  return hash_bytes (&e->block, sizeof e->block) ^ hash_int (e->sector);
+}
+
+/* Orders entries by (block, sector) tag. */
+static bool
+cache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct cache_entry *a = hash_entry (a_, struct cache_entry,
+                                            hash_elem);
+  const struct cache_entry *b = hash_entry (b_, struct cache_entry,
+                                            hash_elem);
+  if (a->block != b->block)
+    return a->block < b->block;
+  return a->sector < b->sector;
+}
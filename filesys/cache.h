@@ -0,0 +1,34 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Default number of sectors held by the buffer cache. */
+#ifndef CACHE_SIZE_DEFAULT
+#define CACHE_SIZE_DEFAULT 64
+#endif
+
+/* -cache: Number of sectors held by the buffer cache. */
+extern size_t cache_size;
+
+/* Ticks between periodic write-behind flushes. */
+#ifndef CACHE_FLUSH_INTERVAL
+#define CACHE_FLUSH_INTERVAL (5 * TIMER_FREQ)
+#endif
+
+void cache_init (void);
+void cache_read (struct block *, block_sector_t, void *);
+void cache_read_at (struct block *, block_sector_t, void *,
+                    int ofs, int size);
+void cache_write (struct block *, block_sector_t, const void *);
+void cache_write_at (struct block *, block_sector_t, const void *,
+                     int ofs, int size);
+void cache_flush (void);
+void cache_flush_sector (struct block *, block_sector_t);
+bool cache_contains (struct block *, block_sector_t);
+void cache_discard (struct block *, block_sector_t);
+void cache_readahead (struct block *, block_sector_t);
+
+#endif /* filesys/cache.h */
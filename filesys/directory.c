@@ -1,16 +1,30 @@
 #include "filesys/directory.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
-/* A directory. */
+/* A directory.
+
+   dir_readdir() returns entries in order of the key (bit-reversed
+   hash of name, name), and remembers the last key it returned
+   rather than a position in the file.  Growing the table moves
+   entries between buckets but never changes their keys, so a walk
+   in progress neither repeats nor skips an entry that stays in the
+   directory. */
 struct dir
   {
     struct inode *inode;                /* Backing store. */
-    off_t pos;                          /* Current position. */
+    bool pos_valid;                     /* Has dir_readdir() returned
+                                           an entry yet? */
+    uint32_t pos_key;                   /* Reversed hash of last name
+                                           returned. */
+    char pos_name[NAME_MAX + 1];        /* Last name returned. */
   };
 
 /* A single directory entry. */
@@ -21,12 +35,83 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* A directory is a hash table of buckets, one sector each.  An
+   entry lives in the bucket its name hashes to or, if that one
+   was full when it was added, in one of the next few buckets,
+   wrapping around.  The number of buckets is a power of 2, and
+   the table doubles when an insertion finds no room within
+   MAX_PROBE buckets, so lookups and insertions read only a
+   bucket or two on average. */
+#define BUCKET_ENTRIES ((BLOCK_SECTOR_SIZE - sizeof (uint32_t)) \
+                        / sizeof (struct dir_entry))
+struct dir_bucket
+  {
+    uint32_t overflow;                  /* Did an insertion pass this
+                                           bucket by because it was
+                                           full? */
+    struct dir_entry entries[BUCKET_ENTRIES];
+    uint8_t unused[BLOCK_SECTOR_SIZE - sizeof (uint32_t)
+                   - BUCKET_ENTRIES * sizeof (struct dir_entry)];
+  };
+
+/* Most buckets an insertion probes before doubling the table. */
+#define MAX_PROBE 4
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  size_t bucket_cnt = 1;
+
+  ASSERT (sizeof (struct dir_bucket) == BLOCK_SECTOR_SIZE);
+  while (bucket_cnt * BUCKET_ENTRIES < entry_cnt)
+    bucket_cnt *= 2;
+  return inode_create (sector, bucket_cnt * sizeof (struct dir_bucket));
+}
+
+/* Returns the number of buckets in DIR.  That is the greatest
+   power of 2 that fits in DIR's length, because a failed
+   doubling may leave extra sectors at the end. */
+static size_t
+bucket_cnt (const struct dir *dir)
+{
+  size_t sectors = inode_length (dir->inode) / sizeof (struct dir_bucket);
+  size_t cnt = 1;
+
+  ASSERT (sectors > 0);
+  while (cnt * 2 <= sectors)
+    cnt *= 2;
+  return cnt;
+}
+
+/* Returns the byte offset of entry slot I of bucket B. */
+static off_t
+entry_ofs (size_t b, size_t i)
+{
+  return (b * sizeof (struct dir_bucket)
+          + offsetof (struct dir_bucket, entries)
+          + i * sizeof (struct dir_entry));
+}
+
+/* Reads bucket B of DIR into *BUCKET.  Returns true if
+   successful, false on failure. */
+static bool
+read_bucket (const struct dir *dir, size_t b, struct dir_bucket *bucket)
+{
+  return (inode_read_at (dir->inode, bucket, sizeof *bucket,
+                         b * sizeof *bucket)
+          == sizeof *bucket);
+}
+
+/* Writes BUCKET as bucket B of DIR.  Returns true if successful,
+   false on failure. */
+static bool
+write_bucket (struct dir *dir, size_t b, const struct dir_bucket *bucket)
+{
+  return (inode_write_at (dir->inode, bucket, sizeof *bucket,
+                          b * sizeof *bucket)
+          == sizeof *bucket);
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -38,7 +123,7 @@ dir_open (struct inode *inode)
   if (inode != NULL && dir != NULL)
     {
       dir->inode = inode;
-      dir->pos = 0;
+      dir->pos_valid = false;
       return dir;
     }
   else
@@ -83,32 +168,103 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
+/* Searches DIR for a file with the given NAME, using BUCKET as
+   scratch space.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   otherwise, returns false and ignores EP and OFSP.
+   The caller must hold DIR's inode lock, see inode_rwlock(). */
 static bool
 lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp)
+        struct dir_entry *ep, off_t *ofsp, struct dir_bucket *bucket)
 {
-  struct dir_entry e;
-  size_t ofs;
+  size_t cnt, b, probe;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (e.in_use && !strcmp (name, e.name))
+  cnt = bucket_cnt (dir);
+  b = hash_string (name) & (cnt - 1);
+  for (probe = 0; probe < cnt; probe++, b = (b + 1) & (cnt - 1))
+    {
+      size_t i;
+
+      if (!read_bucket (dir, b, bucket))
+        return false;
+      for (i = 0; i < BUCKET_ENTRIES; i++)
+        {
+          struct dir_entry *e = &bucket->entries[i];
+          if (e->in_use && !strcmp (name, e->name))
+            {
+              if (ep != NULL)
+                *ep = *e;
+              if (ofsp != NULL)
+                *ofsp = entry_ofs (b, i);
+              return true;
+            }
+        }
+
+      /* No entry that hashes here went past an unfilled bucket. */
+      if (!bucket->overflow)
+        break;
+    }
+  return false;
+}
+
+/* Doubles the number of buckets in DIR and rehashes its entries
+   into them.  Returns true if successful, false on failure, in
+   which case DIR is unchanged. */
+static bool
+grow (struct dir *dir)
+{
+  size_t old_cnt = bucket_cnt (dir);
+  size_t new_cnt = old_cnt * 2;
+  struct dir_bucket *old, *new;
+  size_t b, i;
+  bool success = false;
+
+  old = malloc (old_cnt * sizeof *old);
+  new = calloc (new_cnt, sizeof *new);
+  if (old == NULL || new == NULL
+      || (inode_read_at (dir->inode, old, old_cnt * sizeof *old, 0)
+          != (off_t) (old_cnt * sizeof *old)))
+    goto done;
+
+  for (b = 0; b < old_cnt; b++)
+    for (i = 0; i < BUCKET_ENTRIES; i++)
       {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
+        struct dir_entry *e = &old[b].entries[i];
+        size_t nb, j;
+
+        if (!e->in_use)
+          continue;
+        for (nb = hash_string (e->name) & (new_cnt - 1); ;
+             nb = (nb + 1) & (new_cnt - 1))
+          {
+            for (j = 0; j < BUCKET_ENTRIES; j++)
+              if (!new[nb].entries[j].in_use)
+                break;
+            if (j < BUCKET_ENTRIES)
+              break;
+            new[nb].overflow = 1;
+          }
+        new[nb].entries[j] = *e;
       }
-  return false;
+
+  /* Write the new upper half first.  If the disk fills up, DIR
+     is only left longer, which bucket_cnt() ignores. */
+  if (inode_write_at (dir->inode, new + old_cnt, old_cnt * sizeof *new,
+                      old_cnt * sizeof *new)
+      != (off_t) (old_cnt * sizeof *new))
+    goto done;
+  success = (inode_write_at (dir->inode, new, old_cnt * sizeof *new, 0)
+             == (off_t) (old_cnt * sizeof *new));
+
+ done:
+  free (old);
+  free (new);
+  return success;
 }
 
 /* Searches DIR for a file with the given NAME
@@ -120,15 +276,24 @@ dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode)
 {
   struct dir_entry e;
+  struct dir_bucket *bucket;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
+  *inode = NULL;
+  bucket = malloc (sizeof *bucket);
+  if (bucket == NULL)
+    return false;
+
+  /* Open the inode before dropping the lock, so that a concurrent
+     dir_remove() cannot free its sector in between. */
+  rwlock_acquire_read (inode_rwlock (dir->inode));
+  if (lookup (dir, name, &e, NULL, bucket))
     *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  rwlock_release_read (inode_rwlock (dir->inode));
 
+  free (bucket);
   return *inode != NULL;
 }
 
@@ -141,8 +306,7 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
-  struct dir_entry e;
-  off_t ofs;
+  struct dir_bucket *bucket;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -152,29 +316,55 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  bucket = malloc (sizeof *bucket);
+  if (bucket == NULL)
+    return false;
+  rwlock_acquire_write (inode_rwlock (dir->inode));
+
   /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  if (lookup (dir, name, NULL, NULL, bucket))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (!e.in_use)
-      break;
+  /* Find a free slot in NAME's bucket or one of the next few,
+     marking each full one passed over, or else grow the table
+     and try again. */
+  for (;;)
+    {
+      size_t cnt = bucket_cnt (dir);
+      size_t b = hash_string (name) & (cnt - 1);
+      size_t probe;
 
-  /* Write slot. */
-  e.in_use = true;
-  strlcpy (e.name, name, sizeof e.name);
-  e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+      for (probe = 0; probe < MAX_PROBE && probe < cnt;
+           probe++, b = (b + 1) & (cnt - 1))
+        {
+          size_t i;
+
+          if (!read_bucket (dir, b, bucket))
+            goto done;
+          for (i = 0; i < BUCKET_ENTRIES; i++)
+            if (!bucket->entries[i].in_use)
+              {
+                struct dir_entry *e = &bucket->entries[i];
+                e->in_use = true;
+                strlcpy (e->name, name, sizeof e->name);
+                e->inode_sector = inode_sector;
+                success = write_bucket (dir, b, bucket);
+                goto done;
+              }
+          if (!bucket->overflow)
+            {
+              bucket->overflow = 1;
+              if (!write_bucket (dir, b, bucket))
+                goto done;
+            }
+        }
+      if (!grow (dir))
+        goto done;
+    }
 
  done:
+  rwlock_release_write (inode_rwlock (dir->inode));
+  free (bucket);
   return success;
 }
 
@@ -185,6 +375,7 @@ bool
 dir_remove (struct dir *dir, const char *name)
 {
   struct dir_entry e;
+  struct dir_bucket *bucket;
   struct inode *inode = NULL;
   bool success = false;
   off_t ofs;
@@ -192,8 +383,14 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  bucket = malloc (sizeof *bucket);
+  if (bucket == NULL)
+    return false;
+  rwlock_acquire_write (inode_rwlock (dir->inode));
+
+  /* Find directory entry.  Its bucket keeps its overflow mark,
+     since later entries may have been placed past it. */
+  if (!lookup (dir, name, &e, &ofs, bucket))
     goto done;
 
   /* Open inode. */
@@ -211,26 +408,108 @@ dir_remove (struct dir *dir, const char *name)
   success = true;
 
  done:
+  rwlock_release_write (inode_rwlock (dir->inode));
   inode_close (inode);
+  free (bucket);
   return success;
 }
 
+/* Returns X with its bits in reverse order. */
+static uint32_t
+reverse_bits (uint32_t x)
+{
+  x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+  x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+  x = ((x >> 4) & 0x0f0f0f0f) | ((x & 0x0f0f0f0f) << 4);
+  x = ((x >> 8) & 0x00ff00ff) | ((x & 0x00ff00ff) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+/* Returns true if the entry with reversed hash KEY and name NAME
+   comes after the one with KEY2 and NAME2 in readdir order. */
+static bool
+key_after (uint32_t key, const char *name, uint32_t key2, const char *name2)
+{
+  return key != key2 ? key > key2 : strcmp (name, name2) > 0;
+}
+
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   contains no more entries.
+
+   Entries come back in order of their names' bit-reversed hashes.
+   With 2^K buckets, an entry's home bucket is given by the low K
+   bits of its hash, that is, the top K bits of the reversed hash,
+   so homes are visited in bit-reversed order and each home's
+   entries are gathered from its probe sequence.  Doubling the
+   table splits each home into two that are adjacent in this order,
+   so the walk carries on correctly across a dir_add() that grows
+   the table. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
-  struct dir_entry e;
+  struct dir_bucket *bucket;
+  size_t cnt, bits, pos;
+  uint32_t best_key = 0;
+  bool found = false;
+
+  bucket = malloc (sizeof *bucket);
+  if (bucket == NULL)
+    return false;
+  rwlock_acquire_read (inode_rwlock (dir->inode));
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e)
+  cnt = bucket_cnt (dir);
+  for (bits = 0; ((size_t) 1 << bits) < cnt; bits++)
+    continue;
+  pos = dir->pos_valid && bits > 0 ? dir->pos_key >> (32 - bits) : 0;
+  for (; pos < cnt && !found; pos++)
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
+      size_t home = bits > 0 ? reverse_bits (pos) >> (32 - bits) : 0;
+      size_t b = home, probe;
+
+      for (probe = 0; probe < cnt; probe++, b = (b + 1) & (cnt - 1))
         {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          size_t i;
+
+          if (!read_bucket (dir, b, bucket))
+            {
+              found = false;
+              goto done;
+            }
+          for (i = 0; i < BUCKET_ENTRIES; i++)
+            {
+              struct dir_entry *e = &bucket->entries[i];
+              unsigned hash;
+              uint32_t key;
+
+              if (!e->in_use)
+                continue;
+              hash = hash_string (e->name);
+              if ((hash & (cnt - 1)) != home)
+                continue;
+              key = reverse_bits (hash);
+              if (dir->pos_valid
+                  && !key_after (key, e->name, dir->pos_key, dir->pos_name))
+                continue;
+              if (found && !key_after (best_key, name, key, e->name))
+                continue;
+              strlcpy (name, e->name, NAME_MAX + 1);
+              best_key = key;
+              found = true;
+            }
+          if (!bucket->overflow)
+            break;
         }
     }
-  return false;
+
+  if (found)
+    {
+      dir->pos_valid = true;
+      dir->pos_key = best_key;
+      strlcpy (dir->pos_name, name, sizeof dir->pos_name);
+    }
+ done:
+  rwlock_release_read (inode_rwlock (dir->inode));
+  free (bucket);
+  return found;
 }
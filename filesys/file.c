@@ -1,4 +1,11 @@
 #include "filesys/file.h"
+#include "filesys/iovec.h"
+#include "threads/synch.h"
+
+/* Read-ahead window, in bytes, when sequential reading is first
+   detected, and the size it doubles up to while it continues. */
+#define RA_WINDOW_MIN (4 * BLOCK_SECTOR_SIZE)
+#define RA_WINDOW_MAX (32 * BLOCK_SECTOR_SIZE)
 
 
 /* Opens a file for the given INODE, of which it takes ownership,
@@ -13,6 +20,8 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
@@ -58,8 +67,57 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  struct iovec iov;
+
+  if (size <= 0)
+    return 0;
+  iov.base = buffer;
+  iov.size = size;
+  return file_read_iov (file, &iov, 1);
+}
+
+/* Reads from FILE, starting at the file's current position, into
+   the CNT pieces of IOV, in order.  Returns the number of bytes
+   actually read, which may be less than their total size if end
+   of file is reached.  Advances FILE's position by the number of
+   bytes read. */
+off_t
+file_read_iov (struct file *file, const struct iovec *iov, size_t cnt) 
+{
+  struct rwlock *rw = inode_rwlock (file->inode);
+  off_t bytes_read;
+
+  rwlock_acquire_read (rw);
+  bytes_read = inode_read_iov (file->inode, iov, cnt, file->pos);
+  rwlock_release_read (rw);
+
+  /* A read that picks up where the last one ended means FILE is
+     being streamed: prefetch ahead of it, with a window that
+     grows for as long as the pattern holds. */
+  if (file->pos == file->ra_next && bytes_read > 0)
+    {
+      off_t end = file->pos + bytes_read;
+      off_t start;
+
+      if (file->ra_window == 0)
+        file->ra_window = RA_WINDOW_MIN;
+      else if (file->ra_window < RA_WINDOW_MAX)
+        file->ra_window *= 2;
+      start = end > file->ra_end ? end : file->ra_end;
+      if (start < end + file->ra_window)
+        {
+          rwlock_acquire_read (rw);
+          inode_readahead (file->inode, start,
+                           end + file->ra_window - start);
+          rwlock_release_read (rw);
+          file->ra_end = end + file->ra_window;
+        }
+    }
+  else
+    file->ra_window = 0;
+
   file->pos += bytes_read;
+  file->ra_next = file->pos;
   return bytes_read;
 }
 
@@ -67,24 +125,49 @@ file_read (struct file *file, void *buffer, off_t size)
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually read,
    which may be less than SIZE if end of file is reached.
-   The file's current position is unaffected. */
+   The file's current position is unaffected.
+   Readers of the same inode may proceed concurrently. */
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  struct rwlock *rw = inode_rwlock (file->inode);
+  off_t bytes_read;
+
+  rwlock_acquire_read (rw);
+  bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+  rwlock_release_read (rw);
+  return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
-   Advances FILE's position by the number of bytes read. */
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file grows the file.
+   Advances FILE's position by the number of bytes written. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
 {
-  off_t bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
+  struct iovec iov;
+
+  if (size <= 0)
+    return 0;
+  iov.base = (void *) buffer;
+  iov.size = size;
+  return file_write_iov (file, &iov, 1);
+}
+
+/* Writes the CNT pieces of IOV, in order, into FILE, starting at
+   the file's current position, like file_write(). */
+off_t
+file_write_iov (struct file *file, const struct iovec *iov, size_t cnt) 
+{
+  struct rwlock *rw = inode_rwlock (file->inode);
+  off_t bytes_written;
+
+  rwlock_acquire_write (rw);
+  bytes_written = inode_write_iov (file->inode, iov, cnt, file->pos);
+  rwlock_release_write (rw);
   file->pos += bytes_written;
   return bytes_written;
 }
@@ -92,15 +175,32 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
-   The file's current position is unaffected. */
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file grows the file.
+   The file's current position is unaffected.
+   Writers exclude all other readers and writers of the inode. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
                off_t file_ofs) 
 {
-  return inode_write_at (file->inode, buffer, size, file_ofs);
+  struct rwlock *rw = inode_rwlock (file->inode);
+  off_t bytes_written;
+
+  rwlock_acquire_write (rw);
+  bytes_written = inode_write_at (file->inode, buffer, size, file_ofs);
+  rwlock_release_write (rw);
+  return bytes_written;
+}
+
+/* Writes any of FILE's data that is still only in the buffer
+   cache to disk, returning once it is durable. */
+void
+file_flush (struct file *file) 
+{
+  ASSERT (file != NULL);
+  rwlock_acquire_read (inode_rwlock (file->inode));
+  inode_flush (file->inode);
+  rwlock_release_read (inode_rwlock (file->inode));
 }
 
 /* Prevents write operations on FILE's underlying inode
@@ -112,7 +212,9 @@ file_deny_write (struct file *file)
   if (!file->deny_write) 
     {
       file->deny_write = true;
+      rwlock_acquire_write (inode_rwlock (file->inode));
       inode_deny_write (file->inode);
+      rwlock_release_write (inode_rwlock (file->inode));
     }
 }
 
@@ -126,7 +228,9 @@ file_allow_write (struct file *file)
   if (file->deny_write) 
     {
       file->deny_write = false;
+      rwlock_acquire_write (inode_rwlock (file->inode));
       inode_allow_write (file->inode);
+      rwlock_release_write (inode_rwlock (file->inode));
     }
 }
 
@@ -146,6 +250,11 @@ file_seek (struct file *file, off_t new_pos)
   ASSERT (file != NULL);
   ASSERT (new_pos >= 0);
   file->pos = new_pos;
+
+  /* Start over detecting sequential access. */
+  file->ra_next = new_pos;
+  file->ra_end = new_pos;
+  file->ra_window = 0;
 }
 
 /* Returns the current position in FILE as a byte offset from the
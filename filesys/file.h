@@ -12,11 +12,13 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
-    struct list_elem file_elem;
-    int fd ;
+    off_t ra_next;              /* Where a sequential read would start. */
+    off_t ra_end;               /* End of the range already prefetched. */
+    off_t ra_window;            /* Bytes to prefetch, 0 if not streaming. */
 };
 
 struct inode;
+struct iovec;
 
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
@@ -27,8 +29,13 @@ struct inode *file_get_inode (struct file *);
 /* Reading and writing. */
 off_t file_read (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
+off_t file_read_iov (struct file *, const struct iovec *, size_t cnt);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
+off_t file_write_iov (struct file *, const struct iovec *, size_t cnt);
+
+/* Durability. */
+void file_flush (struct file *);
 
 /* Preventing writes. */
 void file_deny_write (struct file *);
@@ -1,12 +1,20 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <string.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct lock free_map_lock;    /* Guards FREE_MAP and its file. */
+
+/* Number of free map bits held by each sector of its file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+static bool write_bits (size_t start, size_t cnt);
 
 /* Initializes the free map. */
 void
@@ -15,6 +23,7 @@ free_map_init (void)
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  lock_init (&free_map_lock);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
 }
@@ -27,26 +36,113 @@ free_map_init (void)
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  return free_map_allocate_near (0, cnt, sectorp);
+}
+
+/* Like free_map_allocate(), but prefers the first run of CNT free
+   sectors at or after HINT, so that related data ends up close
+   together on disk.  Falls back to searching from the start of
+   the disk. */
+bool
+free_map_allocate_near (block_sector_t hint, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = bitmap_scan_and_flip (free_map, hint, cnt, false);
+  if (sector == BITMAP_ERROR && hint != 0)
+    sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
   if (sector != BITMAP_ERROR
       && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+      && !write_bits (sector, cnt))
     {
       bitmap_set_multiple (free_map, sector, cnt, false); 
       sector = BITMAP_ERROR;
     }
+  lock_release (&free_map_lock);
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates as many of the CNT sectors starting at SECTOR as are
+   free, stopping at the first one in use, and returns the number
+   allocated.  Used to grow a run of sectors in place. */
+size_t
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  for (i = 0; i < cnt && sector + i < bitmap_size (free_map); i++)
+    if (bitmap_test (free_map, sector + i))
+      break;
+  if (i > 0)
+    {
+      bitmap_set_multiple (free_map, sector, i, true);
+      if (free_map_file != NULL && !write_bits (sector, i))
+        {
+          bitmap_set_multiple (free_map, sector, i, false);
+          i = 0;
+        }
+    }
+  lock_release (&free_map_lock);
+  return i;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  write_bits (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Writes the sectors of the free map file that hold bits START
+   through START + CNT - 1 of the free map, rather than the whole
+   map, so that an allocation or release costs a sector write or
+   two however large the disk is.  The writes land in the buffer
+   cache, which batches them to disk.  Returns true if successful,
+   false on failure.  The caller must hold free_map_lock. */
+static bool
+write_bits (size_t start, size_t cnt)
+{
+  static uint8_t buffer[BLOCK_SECTOR_SIZE];
+  size_t bit_cnt = bitmap_size (free_map);
+  off_t file_size = bitmap_file_size (free_map);
+  size_t sector;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+  ASSERT (cnt > 0);
+
+  for (sector = start / BITS_PER_SECTOR;
+       sector <= (start + cnt - 1) / BITS_PER_SECTOR; sector++)
+    {
+      size_t first = sector * BITS_PER_SECTOR;
+      size_t last = first + BITS_PER_SECTOR;
+      off_t ofs = sector * BLOCK_SECTOR_SIZE;
+      off_t size = file_size - ofs;
+      size_t i;
+
+      /* Rebuild the sector in bitmap_write()'s format: bit I is
+         bit I % 8 of byte I / 8. */
+      if (last > bit_cnt)
+        last = bit_cnt;
+      if (size > BLOCK_SECTOR_SIZE)
+        size = BLOCK_SECTOR_SIZE;
+      memset (buffer, 0, sizeof buffer);
+      for (i = first; i < last; i++)
+        if (bitmap_test (free_map, i))
+          buffer[(i - first) / 8] |= 1 << (i % 8);
+
+      if (file_write_at (free_map_file, buffer, size, ofs) != size)
+        return false;
+    }
+  return true;
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -60,7 +156,9 @@ free_map_open (void)
     PANIC ("can't read free map");
 }
 
-/* Writes the free map to disk and closes the free map file. */
+/* Closes the free map file.  Every change has already been
+   written to it, so flushing the buffer cache afterward puts the
+   free map on disk. */
 void
 free_map_close (void) 
 {
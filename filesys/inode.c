@@ -1,24 +1,58 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/cache.h"
+#include "filesys/iovec.h"
 #include "threads/malloc.h"
 #include <stdio.h>
 #include "threads/thread.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Reads and writes of at least this many sectors move whole,
+   uncached sectors between the caller's buffer and the disk
+   directly.  Smaller ones go through the buffer cache, so that
+   they keep benefiting from it. */
+#define DIRECT_MIN 8
+
+/* A run of consecutive data sectors.  END is cumulative, so
+   that the extents of an inode can be binary searched by file
+   position: the extent holds the file's sectors from the
+   previous extent's END (or 0) up to END. */
+struct extent
+  {
+    block_sector_t start;               /* First disk sector, and flag. */
+    uint32_t end;                       /* File sector just past this run. */
+  };
+
+/* Set in an extent's START while its sectors have never been
+   written.  They read as zeros, without touching the disk, and
+   each one is split off into a written extent when it is first
+   written. */
+#define EXTENT_UNWRITTEN 0x80000000u
+
+/* Number of extents held in the inode itself and in its
+   indirect extent block. */
+#define DIRECT_EXTENTS 61
+#define INDIRECT_EXTENTS (BLOCK_SECTOR_SIZE / sizeof (struct extent))
+
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t extent_cnt;                /* Number of extents in use. */
+    block_sector_t indirect;            /* Indirect extent block, if
+                                           EXTENT_CNT > DIRECT_EXTENTS. */
+    uint32_t unused[2];                 /* Not used. */
+    struct extent extents[DIRECT_EXTENTS];      /* First extents. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -32,37 +66,412 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem hash_elem;         /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct rwlock rwlock;               /* Guards contents, see inode_rwlock(). */
     struct inode_disk data;             /* Inode content. */
+    struct extent *indirect;            /* Indirect extents, or null. */
   };
 
+/* Returns extent I of INODE. */
+static struct extent *
+extent_at (struct inode *inode, size_t i)
+{
+  ASSERT (i < inode->data.extent_cnt);
+  return (i < DIRECT_EXTENTS
+          ? &inode->data.extents[i]
+          : &inode->indirect[i - DIRECT_EXTENTS]);
+}
+
+/* Returns true if E's sectors have never been written. */
+static inline bool
+extent_unwritten (const struct extent *e)
+{
+  return (e->start & EXTENT_UNWRITTEN) != 0;
+}
+
+/* Returns the first disk sector of E. */
+static inline block_sector_t
+extent_sector (const struct extent *e)
+{
+  return e->start & ~EXTENT_UNWRITTEN;
+}
+
+/* Returns the first file sector held by extent I of INODE. */
+static size_t
+extent_first (struct inode *inode, size_t i)
+{
+  return i > 0 ? extent_at (inode, i - 1)->end : 0;
+}
+
+/* Returns the number of data sectors allocated to INODE, which
+   may exceed the number its length calls for. */
+static size_t
+allocated_sectors (struct inode *inode)
+{
+  size_t cnt = inode->data.extent_cnt;
+  return cnt > 0 ? extent_at (inode, cnt - 1)->end : 0;
+}
+
+/* Returns the index of the extent of INODE that holds file
+   sector SECTOR_IDX, which must be allocated. */
+static size_t
+find_extent (struct inode *inode, size_t sector_idx)
+{
+  size_t lo, hi;
+
+  ASSERT (sector_idx < allocated_sectors (inode));
+
+  /* Binary search for the first extent that ends past the
+     sector. */
+  lo = 0;
+  hi = inode->data.extent_cnt - 1;
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (extent_at (inode, mid)->end > sector_idx)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+  return lo;
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
+  size_t sector_idx, i;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
+  if (pos < 0 || (size_t) pos >= allocated_sectors (inode) * BLOCK_SECTOR_SIZE)
     return -1;
+
+  sector_idx = pos / BLOCK_SECTOR_SIZE;
+  i = find_extent (inode, sector_idx);
+  return (extent_sector (extent_at (inode, i)) + sector_idx
+          - extent_first (inode, i));
+}
+
+/* Returns true if the sector holding byte offset POS of INODE,
+   which must be allocated, has ever been written. */
+static bool
+sector_written (struct inode *inode, off_t pos)
+{
+  size_t i = find_extent (inode, pos / BLOCK_SECTOR_SIZE);
+  return !extent_unwritten (extent_at (inode, i));
+}
+
+/* Writes INODE's on-disk inode and indirect extent block, if any,
+   to the buffer cache. */
+static void
+write_disk_inode (struct inode *inode)
+{
+  cache_write (fs_device, inode->sector, &inode->data);
+  if (inode->indirect != NULL)
+    cache_write (fs_device, inode->data.indirect, inode->indirect);
+}
+
+/* Writes zeros to the CNT disk sectors starting at SECTOR, in
+   the buffer cache. */
+static void
+zero_sectors (block_sector_t sector, size_t cnt)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+
+  for (; cnt > 0; cnt--)
+    cache_write (fs_device, sector++, zeros);
+}
+
+/* Gives INODE an indirect extent block, allocated near HINT, if
+   it does not have one yet.  Returns true if successful, false if
+   memory or disk allocation fails. */
+static bool
+get_indirect (struct inode *inode, block_sector_t hint)
+{
+  if (inode->indirect != NULL)
+    return true;
+  inode->indirect = calloc (1, BLOCK_SECTOR_SIZE);
+  if (inode->indirect == NULL
+      || !free_map_allocate_near (hint, 1, &inode->data.indirect))
+    {
+      free (inode->indirect);
+      inode->indirect = NULL;
+      return false;
+    }
+  return true;
+}
+
+/* Replaces extents LO through HI - 1 of INODE by the NEW_CNT
+   extents in NEW, moving the extents after them along.  Frees
+   the indirect extent block once nothing is left in it.
+   Returns false, changing nothing, if INODE has no room for the
+   result. */
+static bool
+splice_extents (struct inode *inode, size_t lo, size_t hi,
+                const struct extent new[], size_t new_cnt)
+{
+  size_t old_cnt = inode->data.extent_cnt;
+  size_t cnt = old_cnt - (hi - lo) + new_cnt;
+  size_t i;
+
+  if (cnt > DIRECT_EXTENTS + INDIRECT_EXTENTS
+      || (cnt > DIRECT_EXTENTS && !get_indirect (inode, inode->sector)))
+    return false;
+
+  if (cnt > old_cnt)
+    {
+      inode->data.extent_cnt = cnt;
+      for (i = old_cnt; i-- > hi; )
+        *extent_at (inode, i + (cnt - old_cnt)) = *extent_at (inode, i);
+    }
+  else
+    {
+      for (i = hi; i < old_cnt; i++)
+        *extent_at (inode, i - (old_cnt - cnt)) = *extent_at (inode, i);
+      inode->data.extent_cnt = cnt;
+    }
+  for (i = 0; i < new_cnt; i++)
+    *extent_at (inode, lo + i) = new[i];
+
+  if (cnt <= DIRECT_EXTENTS && inode->indirect != NULL)
+    {
+      free_map_release (inode->data.indirect, 1);
+      free (inode->indirect);
+      inode->indirect = NULL;
+    }
+  return true;
+}
+
+/* Replaces extent I of INODE by the NEW_CNT extents in NEW, which
+   must cover the same file sectors.  A written extent at either
+   end of NEW absorbs the written neighbor next to it if the two
+   are also adjacent on disk, so that a file written sequentially
+   stays in a single extent.  Returns false, changing nothing, if
+   INODE has no room for the result. */
+static bool
+replace_extent (struct inode *inode, size_t i,
+                struct extent new[], size_t new_cnt)
+{
+  struct extent *last = &new[new_cnt - 1];
+  size_t lo = i, hi = i + 1;
+
+  if (hi < inode->data.extent_cnt && !extent_unwritten (last))
+    {
+      struct extent *next = extent_at (inode, hi);
+      size_t last_first = (new_cnt > 1 ? new[new_cnt - 2].end
+                           : extent_first (inode, i));
+
+      if (!extent_unwritten (next)
+          && last->start + (last->end - last_first) == next->start)
+        {
+          last->end = next->end;
+          hi++;
+        }
+    }
+  if (lo > 0 && !extent_unwritten (&new[0]))
+    {
+      struct extent *prev = extent_at (inode, lo - 1);
+
+      if (!extent_unwritten (prev)
+          && (prev->start + (prev->end - extent_first (inode, lo - 1))
+              == new[0].start))
+        {
+          new[0].start = prev->start;
+          lo--;
+        }
+    }
+  return splice_extents (inode, lo, hi, new, new_cnt);
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Makes file sectors IDX through IDX + N - 1 of INODE, which
+   all lie in unwritten extent I, count as written.  The parts of
+   the extent before and after them are split off and stay
+   unwritten.  If INODE has no room for the extra extents, those
+   parts are zeroed instead, so that the whole extent becomes
+   written. */
+static void
+write_extent (struct inode *inode, size_t i, size_t idx, size_t n)
+{
+  struct extent *e = extent_at (inode, i);
+  size_t first = extent_first (inode, i);
+  size_t end = e->end;
+  block_sector_t start = extent_sector (e);
+  struct extent new[3];
+  size_t new_cnt = 0;
+
+  ASSERT (extent_unwritten (e));
+  ASSERT (idx >= first && idx + n <= end);
+
+  if (idx > first)
+    {
+      new[new_cnt].start = start | EXTENT_UNWRITTEN;
+      new[new_cnt++].end = idx;
+    }
+  new[new_cnt].start = start + (idx - first);
+  new[new_cnt++].end = idx + n;
+  if (idx + n < end)
+    {
+      new[new_cnt].start = (start + (idx + n - first)) | EXTENT_UNWRITTEN;
+      new[new_cnt++].end = end;
+    }
+  if (replace_extent (inode, i, new, new_cnt))
+    return;
+
+  zero_sectors (start, idx - first);
+  zero_sectors (start + (idx + n - first), end - (idx + n));
+  new[0].start = start;
+  new[0].end = end;
+  if (!replace_extent (inode, i, new, 1))
+    NOT_REACHED ();
+}
+
+/* Allocates data sectors to INODE until it has at least CNT of
+   them.  New sectors go into unwritten extents, so they read as
+   zeros until written.  Growth extends the last extent in
+   place when the sectors after it are free, so that a file
+   written sequentially stays contiguous; otherwise it starts a
+   new extent as close after the last one as possible, splitting
+   the growth into smaller runs if no large one is free.
+   Returns true if successful, false if the disk is full or INODE
+   has no room for more extents.  On failure, sectors allocated so
+   far stay with INODE.  Does not write the inode to disk. */
+static bool
+extend (struct inode *inode, size_t cnt)
+{
+  size_t have = allocated_sectors (inode);
+
+  while (have < cnt)
+    {
+      size_t want = cnt - have;
+      bool full = (inode->data.extent_cnt
+                   == DIRECT_EXTENTS + INDIRECT_EXTENTS);
+      block_sector_t hint = inode->sector, start;
+      size_t got = 0;
+      struct extent *e;
+
+      if (inode->data.extent_cnt > 0)
+        {
+          e = extent_at (inode, inode->data.extent_cnt - 1);
+          hint = byte_to_sector (inode, (have - 1) * BLOCK_SECTOR_SIZE) + 1;
+          got = free_map_allocate_at (hint, want);
+
+          /* The sectors after a written extent start a new,
+             unwritten one, which merges back into it as they are
+             written.  Only with no room for another extent are
+             they zeroed and added to the written one at once. */
+          if (got > 0 && (extent_unwritten (e) || full))
+            {
+              if (!extent_unwritten (e))
+                zero_sectors (hint, got);
+              e->end += got;
+              have += got;
+              continue;
+            }
+        }
+
+      /* Start a new extent, moving to the indirect block once the
+         inode's own slots are used up. */
+      if (full)
+        return false;
+      if (got > 0)
+        {
+          start = hint;
+          want = got;
+        }
+      else
+        while (!free_map_allocate_near (hint, want, &start))
+          if ((want /= 2) == 0)
+            return false;
+      if (inode->data.extent_cnt == DIRECT_EXTENTS
+          && !get_indirect (inode, start + want))
+        {
+          free_map_release (start, want);
+          return false;
+        }
+
+      inode->data.extent_cnt++;
+      e = extent_at (inode, inode->data.extent_cnt - 1);
+      e->start = start | EXTENT_UNWRITTEN;
+      e->end = have + want;
+      have += want;
+    }
+  return true;
+}
+
+/* Makes the CNT data sectors of INODE starting at file sector
+   IDX count as written, leaving the state of all other sectors
+   alone.  Those never written before are zeroed in the buffer
+   cache first, unless WHOLE is true, because the caller will
+   overwrite them entirely.  Writes the inode to the buffer cache
+   if its extents change. */
+static void
+mark_written (struct inode *inode, size_t idx, size_t cnt, bool whole)
+{
+  bool changed = false;
+
+  while (cnt > 0)
+    {
+      size_t i = find_extent (inode, idx);
+      struct extent *e = extent_at (inode, i);
+      size_t n = e->end - idx < cnt ? e->end - idx : cnt;
+
+      if (extent_unwritten (e))
+        {
+          if (!whole)
+            zero_sectors (extent_sector (e) + (idx - extent_first (inode, i)),
+                          n);
+          write_extent (inode, i, idx, n);
+          changed = true;
+        }
+      idx += n;
+      cnt -= n;
+    }
+  if (changed)
+    write_disk_inode (inode);
+}
+
+/* Returns INODE's data sectors and indirect extent block, if
+   any, to the free map. */
+static void
+release_sectors (struct inode *inode)
+{
+  size_t i;
+  uint32_t prev_end = 0;
+
+  for (i = 0; i < inode->data.extent_cnt; i++)
+    {
+      struct extent *e = extent_at (inode, i);
+      free_map_release (extent_sector (e), e->end - prev_end);
+      prev_end = e->end;
+    }
+  if (inode->indirect != NULL)
+    free_map_release (inode->data.indirect, 1);
+}
+
+/* Open inodes, hashed by sector, so that opening a single inode
+   twice returns the same `struct inode'.  Lookups hold
+   OPEN_INODES_LOCK for reading; insertion and removal hold it for
+   writing. */
+static struct hash open_inodes;
+static struct rwlock open_inodes_lock;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("open inode table allocation failed");
+  rwlock_init (&open_inodes_lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -73,72 +482,103 @@ inode_init (void)
 bool
 inode_create (block_sector_t sector, off_t length)
 {
-  struct inode_disk *disk_inode = NULL;
+  struct inode *inode = NULL;
   bool success = false;
 
   ASSERT (length >= 0);
 
   /* If this assertion fails, the inode structure is not exactly
      one sector in size, and you should fix that. */
-  ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof inode->data == BLOCK_SECTOR_SIZE);
 
-  disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
+  /* Build the inode in a scratch in-memory inode, so that
+     extend() can allocate its data. */
+  inode = calloc (1, sizeof *inode);
+  if (inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      inode->sector = sector;
+      inode->data.length = length;
+      inode->data.magic = INODE_MAGIC;
+      if (extend (inode, bytes_to_sectors (length))) 
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
+          write_disk_inode (inode);
           success = true; 
         } 
-      free (disk_inode);
+      else
+        release_sectors (inode);
+      free (inode->indirect);
+      free (inode);
     }
   return success;
 }
 
+/* Returns the open inode for SECTOR with a new reference, or a
+   null pointer if SECTOR is not open.  OPEN_INODES_LOCK must be
+   held. */
+static struct inode *
+find_open_inode (block_sector_t sector)
+{
+  struct inode key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.hash_elem);
+  return (e != NULL
+          ? inode_reopen (hash_entry (e, struct inode, hash_elem))
+          : NULL);
+}
+
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
    Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
-  struct inode *inode;
+  struct inode *inode, *other;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
-    {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
-    }
+  rwlock_acquire_read (&open_inodes_lock);
+  inode = find_open_inode (sector);
+  rwlock_release_read (&open_inodes_lock);
+  if (inode != NULL)
+    return inode;
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
     return NULL;
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  The disk read happens without the table lock, so
+     recheck for a racing opener before publishing. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  rwlock_init (&inode->rwlock);
+  inode->indirect = NULL;
+  cache_read (fs_device, inode->sector, &inode->data);
+  if (inode->data.extent_cnt > DIRECT_EXTENTS)
+    {
+      inode->indirect = malloc (BLOCK_SECTOR_SIZE);
+      if (inode->indirect == NULL)
+        {
+          free (inode);
+          return NULL;
+        }
+      cache_read (fs_device, inode->data.indirect, inode->indirect);
+    }
+
+  rwlock_acquire_write (&open_inodes_lock);
+  other = find_open_inode (sector);
+  if (other == NULL)
+    hash_insert (&open_inodes, &inode->hash_elem);
+  rwlock_release_write (&open_inodes_lock);
+  if (other != NULL)
+    {
+      free (inode->indirect);
+      free (inode);
+      inode = other;
+    }
   return inode;
 }
 
@@ -147,7 +587,13 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      /* Several readers of the open inode table may reopen the
+         same inode at once. */
+      enum intr_level old_level = intr_disable ();
+      inode->open_cnt++;
+      intr_set_level (old_level);
+    }
   return inode;
 }
 
@@ -168,22 +614,78 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
+  /* Release resources if this was the last opener.  Holding the
+     table lock for writing keeps a concurrent inode_open() from
+     reviving INODE after its count drops to zero. */
+  rwlock_acquire_write (&open_inodes_lock);
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      /* Remove from open inode table and release lock. */
+      hash_delete (&open_inodes, &inode->hash_elem);
+      rwlock_release_write (&open_inodes_lock);
  
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          release_sectors (inode);
         }
 
+      free (inode->indirect);
       free (inode); 
     }
+  else
+    rwlock_release_write (&open_inodes_lock);
+}
+
+/* Writes INODE and any of its data held dirty in the buffer
+   cache back to disk. */
+void
+inode_flush (struct inode *inode)
+{
+  uint32_t prev_end = 0;
+  size_t i;
+
+  cache_flush_sector (fs_device, inode->sector);
+  if (inode->indirect != NULL)
+    cache_flush_sector (fs_device, inode->data.indirect);
+  for (i = 0; i < inode->data.extent_cnt; i++)
+    {
+      struct extent *e = extent_at (inode, i);
+      block_sector_t j;
+
+      for (j = 0; j < e->end - prev_end; j++)
+        cache_flush_sector (fs_device, extent_sector (e) + j);
+      prev_end = e->end;
+    }
+}
+
+/* Starts reading the sectors holding bytes OFFSET through
+   OFFSET + SIZE - 1 of INODE into the buffer cache in the
+   background.  Bytes past the end of INODE are ignored. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset -= offset % BLOCK_SECTOR_SIZE; offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    {
+      /* Unwritten sectors need no reading. */
+      if (sector_written (inode, offset))
+        cache_readahead (fs_device, byte_to_sector (inode, offset));
+    }
+}
+
+/* Returns INODE's reader-writer lock.  Directory code holds it
+   for reading while searching INODE's entries and for writing
+   while adding or removing them. */
+struct rwlock *
+inode_rwlock (struct inode *inode)
+{
+  return &inode->rwlock;
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -195,49 +697,172 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Transfers whole sectors between INODE, starting at byte OFFSET,
+   which must be sector-aligned, and the scatter-gather buffer at
+   byte *IOV_OFS of *IOVP, directly to or from the disk with a
+   single device request.  Writes if WRITE is true, otherwise
+   reads.  Takes sectors for as long as each one lies whole within
+   both the buffer's current piece and the first END bytes of
+   INODE, is not in the buffer cache, and directly follows the
+   previous one on disk, up to SIZE bytes and BLOCK_SEG_MAX
+   segments; reads also stop at the first unwritten sector.
+   Advances *IOVP and *IOV_OFS past the data transferred and
+   returns its size in bytes, possibly 0. */
+static off_t
+transfer_direct (struct inode *inode, bool write,
+                 const struct iovec **iovp, size_t *iov_ofs,
+                 off_t offset, off_t size, off_t end)
+{
+  struct block_segment segs[BLOCK_SEG_MAX];
+  struct block_request r;
+  block_sector_t first = byte_to_sector (inode, offset);
+  size_t seg_cnt = 0;
+  off_t done = 0;
+
+  ASSERT (offset % BLOCK_SECTOR_SIZE == 0);
+
+  while (size - done >= BLOCK_SECTOR_SIZE
+         && end - (offset + done) >= BLOCK_SECTOR_SIZE)
+    {
+      const struct iovec *iov;
+      uint8_t *buffer;
+      block_sector_t sector = byte_to_sector (inode, offset + done);
+
+      while (*iov_ofs == (*iovp)->size)
+        {
+          ++*iovp;
+          *iov_ofs = 0;
+        }
+      iov = *iovp;
+      if (iov->size - *iov_ofs < BLOCK_SECTOR_SIZE
+          || sector != first + done / BLOCK_SECTOR_SIZE
+          || cache_contains (fs_device, sector)
+          || (!write && !sector_written (inode, offset + done)))
+        break;
+
+      /* Kernel addresses map physical memory one to one, so
+         adjacent buffers extend a segment. */
+      buffer = (uint8_t *) iov->base + *iov_ofs;
+      if (seg_cnt > 0
+          && ((uint8_t *) segs[seg_cnt - 1].buffer
+              + segs[seg_cnt - 1].cnt * BLOCK_SECTOR_SIZE) == buffer)
+        segs[seg_cnt - 1].cnt++;
+      else if (seg_cnt < BLOCK_SEG_MAX)
+        {
+          segs[seg_cnt].buffer = buffer;
+          segs[seg_cnt].cnt = 1;
+          seg_cnt++;
+        }
+      else
+        break;
+
+      done += BLOCK_SECTOR_SIZE;
+      *iov_ofs += BLOCK_SECTOR_SIZE;
+    }
+
+  if (seg_cnt > 0)
+    {
+      if (write)
+        mark_written (inode, offset / BLOCK_SECTOR_SIZE,
+                      done / BLOCK_SECTOR_SIZE, true);
+      block_request_init_sg (&r, write, first, segs, seg_cnt, NULL, NULL);
+      block_submit (fs_device, &r);
+      block_wait (&r);
+
+      /* The read-ahead thread may have loaded an old copy of a
+         sector while we were writing it. */
+      if (write)
+        {
+          off_t ofs;
+          for (ofs = 0; ofs < done; ofs += BLOCK_SECTOR_SIZE)
+            cache_discard (fs_device, first + ofs / BLOCK_SECTOR_SIZE);
+        }
+    }
+  return done;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
 off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) 
 {
-  uint8_t *buffer = buffer_;
+  struct iovec iov;
+
+  if (size <= 0)
+    return 0;
+  iov.base = buffer;
+  iov.size = size;
+  return inode_read_iov (inode, &iov, 1, offset);
+}
+
+/* Reads from INODE, starting at position OFFSET, into the IOV_CNT
+   pieces of IOV, in order, until they are full.  Returns the
+   number of bytes actually read, which may be less than their
+   total size if an error occurs or end of file is reached.
+
+   Large reads move whole sectors that are not in the buffer
+   cache straight from the disk into IOV, without copying them
+   through the cache.  The caller must hold INODE's lock for
+   reading. */
+off_t
+inode_read_iov (struct inode *inode, const struct iovec *iov,
+                size_t iov_cnt, off_t offset) 
+{
+  off_t size = iov_size (iov, iov_cnt);
+  bool direct = size >= DIRECT_MIN * BLOCK_SECTOR_SIZE;
+  size_t iov_ofs = 0;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
       block_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      uint8_t *buffer;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
       off_t inode_left = inode_length (inode) - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
-      /* Number of bytes to actually copy out of this sector. */
+      /* Number of bytes to actually copy out of this sector, which
+         must also fit in the current piece of IOV. */
       int chunk_size = size < min_left ? size : min_left;
+      while (iov_ofs == iov->size)
+        {
+          iov++;
+          iov_ofs = 0;
+        }
+      if ((size_t) chunk_size > iov->size - iov_ofs)
+        chunk_size = iov->size - iov_ofs;
       if (chunk_size <= 0)
         break;
+      buffer = (uint8_t *) iov->base + iov_ofs;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      /* Read whole written sectors directly if we can, else copy
+         the chunk out of the buffer cache, or zero it if the
+         sector has never been written. */
+      if (sector_written (inode, offset))
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
+          off_t n = 0;
+
+          if (direct && chunk_size == BLOCK_SECTOR_SIZE)
+            n = transfer_direct (inode, false, &iov, &iov_ofs, offset,
+                                 size, inode_length (inode));
+          if (n > 0)
+            chunk_size = n;
+          else
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              cache_read_at (fs_device, sector_idx, buffer, sector_ofs,
+                             chunk_size);
+              iov_ofs += chunk_size;
             }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+        }
+      else
+        {
+          memset (buffer, 0, chunk_size);
+          iov_ofs += chunk_size;
         }
       
       /* Advance. */
@@ -245,68 +870,97 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
 
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or an error occurs.
+   Writing past end of file extends INODE; any gap between the
+   old end and OFFSET reads back as zeros.  The caller must hold
+   INODE's lock for writing. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
                 off_t offset) 
 {
-  const uint8_t *buffer = buffer_;
+  struct iovec iov;
+
+  if (size <= 0)
+    return 0;
+  iov.base = (void *) buffer;
+  iov.size = size;
+  return inode_write_iov (inode, &iov, 1, offset);
+}
+
+/* Writes the IOV_CNT pieces of IOV, in order, into INODE,
+   starting at OFFSET, like inode_write_at().  Large writes move
+   whole sectors that are not in the buffer cache straight from
+   IOV to the disk, without copying them through the cache. */
+off_t
+inode_write_iov (struct inode *inode, const struct iovec *iov,
+                 size_t iov_cnt, off_t offset) 
+{
+  off_t size = iov_size (iov, iov_cnt);
+  bool direct = size >= DIRECT_MIN * BLOCK_SECTOR_SIZE;
+  size_t iov_ofs = 0;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  off_t old_length = inode_length (inode);
+  size_t old_sectors = allocated_sectors (inode);
+  off_t allocated;
   //if(DEBUG_OMAR)printf("inode %d from %d\n" , inode->deny_write_cnt,thread_current()->tid);
   if (inode->deny_write_cnt)
     return 0;
 
+  /* Allocate space for the write, as much as the disk allows. */
+  if (offset + size > inode_length (inode))
+    extend (inode, bytes_to_sectors (offset + size));
+  allocated = allocated_sectors (inode) * BLOCK_SECTOR_SIZE;
+
   while (size > 0) 
     {
       //if(DEBUG_OMAR)printf("inode %d from %d\n" , size,thread_current()->tid);
       /* Sector to write, starting byte offset within sector. */
       block_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      off_t n = 0;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Bytes left in allocated space, bytes left in sector,
+         lesser of the two. */
+      off_t inode_left = allocated - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
-      /* Number of bytes to actually write into this sector. */
+      /* Number of bytes to actually write into this sector, which
+         must also fit in the current piece of IOV. */
       int chunk_size = size < min_left ? size : min_left;
+      while (iov_ofs == iov->size)
+        {
+          iov++;
+          iov_ofs = 0;
+        }
+      if ((size_t) chunk_size > iov->size - iov_ofs)
+        chunk_size = iov->size - iov_ofs;
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      /* Write whole sectors directly if we can.  Otherwise copy
+         the chunk into the buffer cache.  A partial chunk is
+         merged with the sector's existing contents, which are
+         zeros if it has never been written. */
+      if (direct && chunk_size == BLOCK_SECTOR_SIZE)
+        n = transfer_direct (inode, true, &iov, &iov_ofs, offset, size,
+                             allocated);
+      if (n > 0)
+        chunk_size = n;
+      else
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          mark_written (inode, offset / BLOCK_SECTOR_SIZE, 1,
+                        chunk_size == BLOCK_SECTOR_SIZE);
+          cache_write_at (fs_device, sector_idx,
+                          (uint8_t *) iov->base + iov_ofs, sector_ofs,
+                          chunk_size);
+          iov_ofs += chunk_size;
         }
 
       /* Advance. */
@@ -315,7 +969,13 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       bytes_written += chunk_size;
       //if(DEBUG_OMAR)printf("inode again %d from %d\n" , size,thread_current()->tid);
     }
-  free (bounce);
+
+  /* Extend the length only now that the data is in place. */
+  if (bytes_written > 0 && offset > inode->data.length)
+    inode->data.length = offset;
+  if (inode->data.length != old_length
+      || allocated_sectors (inode) != old_sectors)
+    write_disk_inode (inode);
 
   return bytes_written;
 }
@@ -346,3 +1006,19 @@ inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* Hashes an inode by its sector. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, hash_elem)->sector);
+}
+
+/* Orders inodes by sector. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, hash_elem)->sector
+          < hash_entry (b, struct inode, hash_elem)->sector);
+}
@@ -0,0 +1,29 @@
+#ifndef FILESYS_IOVEC_H
+#define FILESYS_IOVEC_H
+
+#include <stddef.h>
+
+/* A piece of a scatter-gather buffer: SIZE bytes at BASE, which
+   must be a kernel address.  A user buffer is described by one
+   piece per page that it touches, each giving the kernel address
+   of the part of that page in the buffer. */
+struct iovec
+  {
+    void *base;                 /* Start of piece. */
+    size_t size;                /* Number of bytes in piece. */
+  };
+
+/* Maximum number of pieces passed down at once. */
+#define IOV_MAX 16
+
+/* Returns the total number of bytes in the CNT pieces of IOV. */
+static inline size_t
+iov_size (const struct iovec *iov, size_t cnt)
+{
+  size_t size = 0;
+  while (cnt-- > 0)
+    size += iov++->size;
+  return size;
+}
+
+#endif /* filesys/iovec.h */
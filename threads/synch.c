@@ -170,68 +170,111 @@ lock_init(struct lock *lock) {
     sema_init(&lock->semaphore, 1);
 }
 
-/* Get maximum donation from waiters of lock lock */
-int
+/* Get maximum donation from waiters of lock lock.  The waiters
+   list is kept sorted by effective priority, so this is the
+   priority of its front thread. */
+static int
 get_donation(struct lock *lock) {
     struct list *waiters = &lock->semaphore.waiters;
-    int maxi = 0;
-    for (struct list_elem *iter = list_begin(waiters);
-         iter != list_end(waiters);
-         iter = list_next(iter)) {
-        struct thread *t = list_entry(iter, struct thread, elem);
-        maxi = max(max(maxi, t->don_priority), t->priority);
-        t->lock_holder = thread_current();
-        t->blocking_sema_list = &lock->semaphore.waiters;
-    }
-    return maxi;
+    if (list_empty(waiters))
+        return PRI_MIN;
+    return get_priority_of_specific_thread(list_entry(list_front(waiters), struct thread, elem));
 }
 
-/* Get maximum donation from waiters of lock lock */
-void
+/* Add the donation of the waiters still queued on lock lock, which the current thread just acquired */
+static void
 getDonationFromWaiters(struct lock *lock) {
     thread_current()->don_priority = max(get_donation(lock), thread_current()->don_priority);
 }
 
+/* Donates the current thread's priority to the holder of LOCK and
+   onward along the chain of holders each blocked on another lock,
+   following at most MAX_DEPTH links.  Each donee is moved to its
+   new position in whatever queue it sits in: the ready queue or
+   the waiters list of the semaphore it is blocked on.
+   Interrupts must be off. */
+static void
+donate_priority(struct lock *lock) {
+    int priority = thread_get_priority();
+
+    ASSERT(intr_get_level() == INTR_OFF);
+
+    for (int depth = 0; depth < MAX_DEPTH && lock != NULL && lock->holder != NULL; depth++) {
+        struct thread *holder = lock->holder;
+        if (get_priority_of_specific_thread(holder) >= priority)
+            break;
+        holder->don_priority = priority;
+        if (holder->status == THREAD_READY)
+            thread_requeue(holder);
+        else if (holder->blocking_sema_list != NULL)
+            reinsert_thread_in_list(holder, holder->blocking_sema_list);
+        lock = holder->waiting_lock;
+    }
+}
+
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
 
+   If LOCK is held by a lower-priority thread, the current thread
+   donates its priority to the holder, and transitively to the
+   holders of the locks that thread is waiting for.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
    we need to sleep. */
+void
+lock_acquire(struct lock *lock) {
+    struct thread *cur = thread_current();
+    enum intr_level old_level;
 
- void
- lock_acquire (struct lock *lock)
- {
-   ASSERT (lock != NULL);
-   ASSERT (!intr_context ());
-   ASSERT (!lock_held_by_current_thread (lock));
+    ASSERT(lock != NULL);
+    ASSERT(!intr_context());
+    ASSERT(!lock_held_by_current_thread(lock));
 
-   sema_down (&lock->semaphore);
-   lock->holder = thread_current ();
- }
+    old_level = intr_disable();
+    if (lock->holder != NULL && !thread_mlfqs) {
+        cur->waiting_lock = lock;
+        donate_priority(lock);
+    }
+    sema_down(&lock->semaphore);
+    cur->waiting_lock = NULL;
+    lock->holder = cur;
+    list_push_back(&cur->my_locks, &lock->lock_elem);
+    if (!thread_mlfqs)
+        getDonationFromWaiters(lock);
+    intr_set_level(old_level);
+}
 
 /* Tries to acquires LOCK and returns true if successful or false
    on failure.  The lock must not already be held by the current
    thread.
 
-   This function will not sleep, so it may be called within an
-   interrupt handler. */
+   This function will not sleep, but it records the lock as held
+   by the current thread for priority donation, so it must not be
+   called within an interrupt handler. */
 bool
 lock_try_acquire(struct lock *lock) {
     bool success;
 
     ASSERT(lock != NULL);
+    ASSERT(!intr_context());
     ASSERT(!lock_held_by_current_thread(lock));
     success = sema_try_down(&lock->semaphore);
     if (success) {
+        enum intr_level old_level = intr_disable();
         lock->holder = thread_current();
+        list_push_back(&thread_current()->my_locks, &lock->lock_elem);
+        intr_set_level(old_level);
     }
     return success;
 }
-/* Removes lock from my_locks list of thread and get new donation from the locks the threads holds*/
-void remove_lock_and_get_donation(struct lock *lock) {
+
+/* Removes lock from my_locks list of thread and get new donation from the locks the threads holds.
+   Costs O(number of locks still held). */
+static void
+remove_lock_and_get_donation(struct lock *lock) {
     list_remove(&lock->lock_elem);
     struct thread *t = thread_current();
     int maxi = 0;
@@ -245,20 +288,29 @@ void remove_lock_and_get_donation(struct lock *lock) {
 }
 
 /* Releases LOCK, which must be owned by the current thread.
+   Drops any priority donated through LOCK, then wakes the
+   highest-priority waiter, yielding to it if it now outranks
+   the current thread.
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to release a lock within an interrupt
    handler. */
+void
+lock_release(struct lock *lock) {
+    enum intr_level old_level;
 
- void
- lock_release (struct lock *lock)
- {
-   ASSERT (lock != NULL);
-   ASSERT (lock_held_by_current_thread (lock));
+    ASSERT(lock != NULL);
+    ASSERT(lock_held_by_current_thread(lock));
 
-   lock->holder = NULL;
-   sema_up (&lock->semaphore);
- }
+    old_level = intr_disable();
+    lock->holder = NULL;
+    if (thread_mlfqs)
+        list_remove(&lock->lock_elem);
+    else
+        remove_lock_and_get_donation(lock);
+    sema_up(&lock->semaphore);
+    intr_set_level(old_level);
+}
 
 
 /* Returns true if the current thread holds LOCK, false
@@ -270,6 +322,122 @@ lock_held_by_current_thread(const struct lock *lock) {
 
     return lock->holder == thread_current();
 }
+/* Initializes RW as unheld. */
+void
+rwlock_init(struct rwlock *rw) {
+    ASSERT(rw != NULL);
+
+    lock_init(&rw->write_lock);
+    sema_init(&rw->drained, 0);
+    rw->readers = 0;
+    rw->writer_waiting = false;
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   is waiting for it.  Other readers may hold RW at the same
+   time.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read(struct rwlock *rw) {
+    enum intr_level old_level;
+
+    ASSERT(rw != NULL);
+
+    lock_acquire(&rw->write_lock);
+    old_level = intr_disable();
+    rw->readers++;
+    intr_set_level(old_level);
+    lock_release(&rw->write_lock);
+}
+
+/* Tries to acquire RW for reading without sleeping.  Returns
+   true if successful, false if a writer holds or is waiting for
+   RW. */
+bool
+rwlock_try_acquire_read(struct rwlock *rw) {
+    enum intr_level old_level;
+
+    ASSERT(rw != NULL);
+
+    if (!lock_try_acquire(&rw->write_lock))
+        return false;
+    old_level = intr_disable();
+    rw->readers++;
+    intr_set_level(old_level);
+    lock_release(&rw->write_lock);
+    return true;
+}
+
+/* Releases read access to RW, waking the waiting writer if this
+   was the last reader. */
+void
+rwlock_release_read(struct rwlock *rw) {
+    enum intr_level old_level;
+
+    ASSERT(rw != NULL);
+
+    old_level = intr_disable();
+    ASSERT(rw->readers > 0);
+    if (--rw->readers == 0 && rw->writer_waiting)
+        sema_up(&rw->drained);
+    intr_set_level(old_level);
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds
+   it.  New readers are held off as soon as we start waiting.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write(struct rwlock *rw) {
+    enum intr_level old_level;
+
+    ASSERT(rw != NULL);
+
+    lock_acquire(&rw->write_lock);
+    old_level = intr_disable();
+    while (rw->readers > 0) {
+        rw->writer_waiting = true;
+        sema_down(&rw->drained);
+    }
+    rw->writer_waiting = false;
+    intr_set_level(old_level);
+}
+
+/* Tries to acquire RW for writing without sleeping.  Returns true
+   if successful, false if any other thread holds RW. */
+bool
+rwlock_try_acquire_write(struct rwlock *rw) {
+    ASSERT(rw != NULL);
+
+    if (!lock_try_acquire(&rw->write_lock))
+        return false;
+    if (rw->readers > 0) {
+        lock_release(&rw->write_lock);
+        return false;
+    }
+    return true;
+}
+
+/* Releases write access to RW, which the current thread must
+   hold. */
+void
+rwlock_release_write(struct rwlock *rw) {
+    ASSERT(rw != NULL);
+
+    lock_release(&rw->write_lock);
+}
+
+/* Returns true if the current thread holds RW for writing. */
+bool
+rwlock_held_for_write(const struct rwlock *rw) {
+    ASSERT(rw != NULL);
+
+    return lock_held_by_current_thread(&rw->write_lock) && rw->readers == 0;
+}
+
 /* One semaphore in a list. */
 struct semaphore_elem {
     struct list_elem elem;              /* List element. */
@@ -32,6 +32,32 @@ bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
 
+/* Reader-writer lock.
+
+   Any number of readers, or a single writer, may hold the lock.
+   The writer holds WRITE_LOCK for its whole critical section, so
+   threads that block behind it donate their priority to it as
+   with a plain lock.  Readers pass through WRITE_LOCK only long
+   enough to register, so once a writer is queued, new readers
+   wait behind it (writer preference), and waiters of either kind
+   are admitted in priority order. */
+struct rwlock
+  {
+    struct lock write_lock;     /* Held by the writer; passed through by readers. */
+    struct semaphore drained;   /* Up'd when the last reader leaves. */
+    unsigned readers;           /* Number of threads holding read access. */
+    bool writer_waiting;        /* Is the writer waiting on DRAINED? */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+bool rwlock_try_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+bool rwlock_try_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_for_write (const struct rwlock *);
+
 /* Condition variable. */
 struct condition
   {
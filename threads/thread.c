@@ -26,6 +26,24 @@
 /* Lock used by allocate_tid(). */
 static struct lock tid_lock;
 
+/* Threads in THREAD_READY state, that is, threads that are ready
+   to run but not actually running.  There is one FIFO per
+   priority level; bit P of ready_bitmap is set iff
+   ready_queues[P] is non-empty, so the highest ready priority is
+   found with a single find-last-set. */
+static struct list ready_queues[PRI_CNT];
+static uint64_t ready_bitmap;
+static size_t ready_cnt;        /* # of threads in all ready_queues. */
+
+/* MLFQS.  recent_cpu decays once per second by a coefficient that
+   depends only on load_avg, so the coefficient is computed once
+   per second and kept for the last DECAY_HISTORY seconds.  Each
+   thread records in mlfqs_epoch the last second it was decayed
+   for, which lets blocked threads be decayed lazily. */
+#define DECAY_HISTORY 64
+static struct real decay_history[DECAY_HISTORY];
+static int mlfqs_epoch;         /* # of seconds since boot. */
+
 /* Stack frame for kernel_thread(). */
 struct kernel_thread_frame {
     void *eip;                  /* Return address. */
@@ -67,6 +85,14 @@ void thread_schedule_tail(struct thread *prev);
 
 static tid_t allocate_tid(void);
 
+static void ready_queue_push(struct thread *);
+
+static void ready_queue_remove(struct thread *);
+
+static int ready_queue_max_priority(void);
+
+static void update_load_average(void);
+
 int max(int a, int b);
 
 struct thread *get_process_with_specific_tid(tid_t tid);
@@ -90,10 +116,11 @@ void
 thread_init(void) {
     ASSERT(intr_get_level() == INTR_OFF);
     lock_init(&tid_lock);
-    lock_init(&open_lock);
-    list_init(&ready_list);
+    for (int i = 0; i < PRI_CNT; i++)
+        list_init(&ready_queues[i]);
+    ready_bitmap = 0;
+    ready_cnt = 0;
     list_init(&all_list);
-    list_init(&sleeping_threads);
     /* Set up a thread structure for the running thread. */
     initial_thread = running_thread();
     init_thread(initial_thread, "main", PRI_DEFAULT, 0, 0);
@@ -118,21 +145,53 @@ thread_start(void) {
 }
 
 
-/* calculate_recent_cpu_for_all_threads */
+/* Applies to T every once-per-second recent_cpu decay it has
+   missed since it last caught up, then recomputes its priority.
+   Decays older than DECAY_HISTORY seconds are dropped; by then
+   their contribution has all but vanished. */
+static void
+mlfqs_catch_up(struct thread *t) {
+    int missed = mlfqs_epoch - t->mlfqs_epoch;
+
+    if (missed == 0)
+        return;
+    if (missed > DECAY_HISTORY)
+        missed = DECAY_HISTORY;
+    for (int e = mlfqs_epoch - missed + 1; e <= mlfqs_epoch; e++) {
+        struct real x = mul_real_real(&decay_history[e % DECAY_HISTORY], &t->recent_cpu);
+        t->recent_cpu = add_real_int(&x, t->nice);
+    }
+    t->mlfqs_epoch = mlfqs_epoch;
+    mlfqs_set_priority_for_specific_thread(t);
+}
+
+/* Once-per-second MLFQS work: updates load_avg, computes this
+   second's decay coefficient 2*load_avg/(2*load_avg+1) once, and
+   decays the running and ready threads, moving ready threads
+   between buckets as their priorities change.  Blocked threads
+   are left alone and catch up in thread_unblock(). */
 static void
-calculate_recent_cpu_for_all_threads(void) {
-    for (struct list_elem *iter = list_begin(&all_list);
-         iter != list_end(&all_list);
-         iter = list_next(iter)) {
-        struct thread *t = list_entry(iter, struct thread, allelem);
-        struct real x, y, z;
-        x = mul_real_int(&load_avg, 2);
-        y = mul_real_int(&load_avg, 2);
-        y = add_real_int(&y, 1);
-        z = div_real_real(&x, &y);
-        x = mul_real_real(&z, &t->recent_cpu);
-        y = add_real_int(&x, t->nice);
-        t->recent_cpu.val = y.val;
+mlfqs_second(void) {
+    struct real x, y;
+
+    update_load_average();
+    mlfqs_epoch++;
+    x = mul_real_int(&load_avg, 2);
+    y = add_real_int(&x, 1);
+    decay_history[mlfqs_epoch % DECAY_HISTORY] = div_real_real(&x, &y);
+
+    if (thread_current() != idle_thread)
+        mlfqs_catch_up(thread_current());
+    for (int pri = PRI_MAX; pri >= PRI_MIN; pri--) {
+        struct list *q = &ready_queues[pri];
+        struct list_elem *e, *next;
+
+        if ((ready_bitmap & ((uint64_t) 1 << pri)) == 0)
+            continue;
+        for (e = list_begin(q); e != list_end(q); e = next) {
+            next = list_next(e);
+            mlfqs_catch_up(list_entry(e, struct thread, elem));
+        }
     }
 }
 
@@ -146,7 +205,7 @@ update_load_average(void) {
     z = mul_real_real(&z, &load_avg);
     x = int_to_real(1);
     x = div_real_real(&x, &y);
-    int ready_size = (int) list_size(&ready_list);
+    int ready_size = (int) ready_cnt;
     if (thread_current() != idle_thread) ready_size++;
     x = mul_real_int(&x, ready_size);
     load_avg = add_real_real(&z, &x);
@@ -167,17 +226,21 @@ thread_tick(void) {
     else
         kernel_ticks++;
 
-    thread_current()->recent_cpu.val = add_real_int(&thread_current()->recent_cpu, 1).val;
+    if (t != idle_thread)
+        t->recent_cpu = add_real_int(&t->recent_cpu, 1);
 
-    /* update_load_average and calculate_recent_cpu_for_all_threads every TIMER_FREQ */
-    if (timer_ticks() % TIMER_FREQ == 0 && thread_mlfqs) {
-        update_load_average();
-        calculate_recent_cpu_for_all_threads();
-    }
-    /*update_priority_of_all_threads and resorting the ready list every 4 ticks*/
-    if (timer_ticks() % 4 == 0 && thread_mlfqs) {
-        update_priority_of_all_threads();
-        list_sort(&ready_list, &more_priority_cmp, NULL);
+    /* Only the running thread's recent_cpu changes between
+       seconds, so it is the only priority to recompute every 4
+       ticks.  Cost is independent of the number of threads. */
+    if (thread_mlfqs) {
+        int64_t now = timer_ticks();
+
+        if (now % TIMER_FREQ == 0)
+            mlfqs_second();
+        else if (now % 4 == 0 && t != idle_thread)
+            mlfqs_set_priority_for_specific_thread(t);
+        if (ready_queue_max_priority() > thread_get_priority())
+            intr_yield_on_return();
     }
 
     /* Enforce preemption. */
@@ -185,6 +248,16 @@ thread_tick(void) {
         intr_yield_on_return();
 }
 
+/* Accounts for CNT timer ticks that the timer skipped while the
+   idle thread ran tickless.  Called by the timer with
+   interrupts off. */
+void
+thread_idle_catch_up(int64_t cnt) {
+    ASSERT(intr_get_level() == INTR_OFF);
+    ASSERT(thread_current() == idle_thread);
+    idle_ticks += cnt;
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats(void) {
@@ -288,12 +361,12 @@ thread_unblock(struct thread *t) {
 
     old_level = intr_disable();
     ASSERT(t->status == THREAD_BLOCKED);
+    if (thread_mlfqs)
+        mlfqs_catch_up(t);
     t->status = THREAD_READY;
-    list_insert_ordered(&ready_list, &t->elem, &more_priority_cmp, NULL);
-    //msg("unblock2 %d %s",list_size(&ready_list),thread_current()->name);
+    ready_queue_push(t);
     if (thread_current() != idle_thread && !intr_context() &&
         get_priority_of_specific_thread(t) >= get_priority_of_specific_thread(thread_current())) {
-        // msg("ready %s",list_entry(list_front(&ready_list), struct thread, elem)->name);
         intr_set_level(old_level);
         thread_yield();
     }
@@ -314,6 +387,26 @@ reinsert_thread_in_list(struct thread *t, struct list *l) {
     list_insert_ordered(l, &t->elem, &more_priority_cmp, NULL);
 }
 
+/* Moves T to the ready queue bucket matching its current
+   effective priority.  Must be called after T's priority or
+   donation changes; does nothing unless T is THREAD_READY. */
+void
+thread_requeue(struct thread *t) {
+    enum intr_level old_level = intr_disable();
+    if (t->status == THREAD_READY
+        && t->ready_pri != get_priority_of_specific_thread(t)) {
+        ready_queue_remove(t);
+        ready_queue_push(t);
+    }
+    intr_set_level(old_level);
+}
+
+/* Returns the number of threads in THREAD_READY state. */
+size_t
+thread_ready_count(void) {
+    return ready_cnt;
+}
+
 
 /* Returns the running thread.
    This is running_thread() plus a couple of sanity checks.
@@ -370,7 +463,7 @@ thread_yield(void) {
 
     old_level = intr_disable();
     if (cur != idle_thread) {
-        list_insert_ordered(&ready_list, &cur->elem, &more_priority_cmp, NULL);
+        ready_queue_push(cur);
     }
     cur->status = THREAD_READY;
     schedule();
@@ -413,10 +506,16 @@ priority_bound(int priority) {
 /* Sets the current thread's priority to NEW_PRIORITY. */
 void
 thread_set_priority(int new_priority) {
+    enum intr_level old_level;
+    int max_ready;
+
+    if (thread_mlfqs)
+        return;
     thread_current()->priority = new_priority;
-    struct thread *t;
-    if (!list_empty(&ready_list) && (t = list_entry(list_front(&ready_list), struct thread, elem))->
-            priority > thread_get_priority() && t != NULL) {
+    old_level = intr_disable();
+    max_ready = ready_queue_max_priority();
+    intr_set_level(old_level);
+    if (max_ready > thread_get_priority()) {
         thread_yield();
     }
 }
@@ -446,6 +545,7 @@ mlfqs_set_priority_for_specific_thread(struct thread *t) {
     x = div_real_int(&t->recent_cpu, 4);
     t->priority = PRI_MAX - real_truncate(&x) - (t->nice * 2);
     t->priority = priority_bound(t->priority);
+    thread_requeue(t);
 }
 
 /*sets the nice value for thread t and update its priority*/
@@ -502,6 +602,10 @@ idle(void *idle_started_ UNUSED) {
         intr_disable();
         thread_block();
 
+        /* Nothing is ready to run, so stop taking a timer
+           interrupt every tick until the next deadline. */
+        timer_idle_enter();
+
         /* Re-enable interrupts and wait for the next one.
 
            The `sti' instruction disables interrupts until the
@@ -515,6 +619,10 @@ idle(void *idle_started_ UNUSED) {
            See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a]
            7.11.1 "HLT Instruction". */
         asm volatile ("sti; hlt" : : : "memory");
+
+        /* Some interrupt woke us; resynchronize the tick count
+           in case it was not the timer's. */
+        timer_idle_exit();
     }
 }
 
@@ -568,17 +676,19 @@ init_thread(struct thread *t, const char *name, int priority, int recent_cpu_val
 #ifdef USERPROG
     sema_init(&t->exec_sema, 0);
     sema_init(&t->waiting_for_child, 0);
-    list_init(&t->my_opened_files_list);
-    t->fd = 1;
+    t->fd_table = NULL;
+    t->fd_cap = 0;
+    t->fd_free = 2;                 /* First fd after the console. */
     if(list_size(&all_list)>0) {
       t->parent = thread_current();
     }
     else t->parent=NULL;
 #endif
     list_init(&t->my_locks);
-    t->lock_holder = NULL;
+    t->waiting_lock = NULL;
     t->blocking_sema_list = NULL;
     t->magic = THREAD_MAGIC;
+    t->mlfqs_epoch = mlfqs_epoch;
     if (thread_mlfqs) {
         t->recent_cpu.val = recent_cpu_val;
         t->nice = nice;
@@ -608,11 +718,54 @@ alloc_frame(struct thread *t, size_t size) {
    idle_thread. */
 static struct thread *
 next_thread_to_run(void) {
-    if (list_empty(&ready_list))
+    struct thread *t;
+
+    if (ready_bitmap == 0)
         return idle_thread;
-    else
-        return list_entry(list_pop_front(&ready_list),
-                          struct thread, elem);
+    t = list_entry(list_front(&ready_queues[ready_queue_max_priority()]),
+                   struct thread, elem);
+    ready_queue_remove(t);
+    return t;
+}
+
+/* Appends T to the tail of the ready queue bucket for its
+   effective priority.  Interrupts must be off. */
+static void
+ready_queue_push(struct thread *t) {
+    int pri = get_priority_of_specific_thread(t);
+
+    ASSERT(intr_get_level() == INTR_OFF);
+    ASSERT(PRI_MIN <= pri && pri <= PRI_MAX);
+    t->ready_pri = pri;
+    list_push_back(&ready_queues[pri], &t->elem);
+    ready_bitmap |= (uint64_t) 1 << pri;
+    ready_cnt++;
+}
+
+/* Removes T from its ready queue bucket.  Interrupts must be
+   off. */
+static void
+ready_queue_remove(struct thread *t) {
+    ASSERT(intr_get_level() == INTR_OFF);
+    list_remove(&t->elem);
+    if (list_empty(&ready_queues[t->ready_pri]))
+        ready_bitmap &= ~((uint64_t) 1 << t->ready_pri);
+    ready_cnt--;
+}
+
+/* Returns the highest priority of any ready thread, or -1 if no
+   thread is ready.  Splits the bitmap in halves so that only the
+   32-bit bsr is needed; we do not link against libgcc. */
+static int
+ready_queue_max_priority(void) {
+    uint32_t hi = ready_bitmap >> 32;
+    uint32_t lo = ready_bitmap;
+
+    if (hi != 0)
+        return 63 - __builtin_clz(hi);
+    if (lo != 0)
+        return 31 - __builtin_clz(lo);
+    return -1;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -2,6 +2,7 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
 #include <stdint.h>
 #include "threads/real.h"
@@ -18,14 +19,6 @@
 
 /* Initial thread, the thread running init.c:main().*/
 struct thread *initial_thread;
-struct lock open_lock;
-
-/*List of sleeping threads*/
-struct list sleeping_threads;
-
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-struct list ready_list;
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -56,6 +49,7 @@ typedef int tid_t;
 #define PRI_MIN 0                       /* Lowest priority. */
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
+#define PRI_CNT (PRI_MAX - PRI_MIN + 1)   /* Number of priority levels. */
 
 /* A kernel thread or user process.
 
@@ -123,19 +117,19 @@ struct thread
     enum thread_status status;          /* Thread state. */
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int64_t time_to_wake_up;            /* time where thread should wake up*/
     int priority;                       /* Priority. */
     int don_priority;                   /* Donated priority */
     int nice;                           /* Nice value for thread */
+    int ready_pri;                      /* Ready queue bucket while THREAD_READY. */
 
     struct list_elem allelem;           /* List element for all threads list. */
 
     struct real recent_cpu;             /* Thread's recent cpu */
+    int mlfqs_epoch;                    /* Last second recent_cpu was decayed for. */
 
     struct list my_locks ;              /* List of locks the thread holds */
     struct list * blocking_sema_list;   /* Pointer to the waiters list for the blocking sema*/
-    struct thread *lock_holder ;        /* Pointer to the Thread Thats holds the lock that caused the blocking*/
-    int fd;
+    struct lock *waiting_lock;          /* Lock the thread is blocked on, if any; its holder is the next donee */
     struct lock exec_lock;
     /* Shared between thread.c and synch.c. and timer.c */
     struct list_elem elem;              /* List element. */
@@ -148,8 +142,15 @@ struct thread
     struct semaphore waiting_for_child;
     struct semaphore exec_sema;
     struct thread *parent;
-    struct list my_opened_files_list ;
+    struct file **fd_table;             /* Open files indexed by fd, or null. */
+    int fd_cap;                         /* Number of slots in FD_TABLE. */
+    int fd_free;                        /* No free fd is below this one. */
     struct file * my_exec_file ;
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash pages;                  /* Supplemental page table. */
+    int pinned_cnt;                     /* Pages pinned by page_pin(). */
+#endif
 #endif
 
     /* Owned by thread.c. */
@@ -175,6 +176,7 @@ void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
+void thread_idle_catch_up (int64_t ticks);
 void thread_print_stats (void);
 
 typedef void thread_func (void *aux);
@@ -200,6 +202,8 @@ bool more_priority_cmp(const struct list_elem* a, const struct list_elem* b, voi
 int max(int a, int b);
 int get_priority_of_specific_thread(struct thread * t);
 void reinsert_thread_in_list(struct thread *t, struct list *l);
+void thread_requeue(struct thread *t);
+size_t thread_ready_count(void);
 void mlfqs_set_priority_for_specific_thread(struct thread * t);
 int thread_get_priority (void);
 void thread_set_priority (int);
@@ -6,6 +6,9 @@
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -156,6 +159,11 @@ page_fault(struct intr_frame *f)
    if (fault_addr == NULL || !not_present || !is_user_vaddr(fault_addr)) {
      ourExit(-1);
    }
+#ifdef VM
+   /* Bring in a page the process has not touched yet. */
+   if (page_load(fault_addr))
+     return;
+#endif
      struct thread *cur = thread_current();
    if (!pagedir_get_page(cur->pagedir, fault_addr)) {
      ourExit(-1);
@@ -18,6 +18,10 @@
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "userprog/syscall.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 #define MAX_CHILD_DEPTH 31
 static thread_func start_process NO_RETURN;
@@ -73,7 +77,6 @@ start_process(void *file_name_) {
     else{
       thread_current()->parent->exec_success=false;
       sema_up(&thread_current()->parent->exec_sema);
-      lock_acquire(&open_lock);
       ourExit(-1);
     }
 
@@ -152,6 +155,9 @@ process_exit(void) {
            that's been freed (and cleared). */
         cur->pagedir = NULL;
         pagedir_activate(NULL);
+#ifdef VM
+        page_table_destroy(pd);
+#endif
         pagedir_destroy(pd);
     }
 }
@@ -256,6 +262,13 @@ load(const char *file_name, void (**eip)(void), void **esp) {
     t->pagedir = pagedir_create();
     if (t->pagedir == NULL)
         goto done;
+#ifdef VM
+    if (!page_table_create()) {
+        pagedir_destroy(t->pagedir);
+        t->pagedir = NULL;
+        goto done;
+    }
+#endif
     process_activate();
 
     /* Open executable file. */
@@ -264,7 +277,9 @@ load(const char *file_name, void (**eip)(void), void **esp) {
     if (usr_program == NULL) return false;
     char * save_ptr;
     usr_program = strtok_r(usr_program, " ", &save_ptr);
+    lock_acquire(&filesys_lock);
     file = filesys_open(usr_program);
+    lock_release(&filesys_lock);
     if (file == NULL) {
         printf("load: %s: open failed\n", file_name);
         goto done;
@@ -411,6 +426,10 @@ validate_segment(const struct Elf32_Phdr *phdr, struct file *file) {
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With VM, the pages are only recorded in the supplemental page
+   table here, and each one is read in when the process first
+   touches it.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
@@ -420,6 +439,22 @@ load_segment(struct file *file, off_t ofs, uint8_t *upage,
     ASSERT (pg_ofs(upage) == 0);
     ASSERT (ofs % PGSIZE == 0);
 
+#ifdef VM
+    while (read_bytes > 0 || zero_bytes > 0) {
+        size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
+        size_t page_zero_bytes = PGSIZE - page_read_bytes;
+
+        if (!page_add_file(upage, file, ofs, page_read_bytes, writable))
+            return false;
+
+        /* Advance. */
+        read_bytes -= page_read_bytes;
+        zero_bytes -= page_zero_bytes;
+        ofs += page_read_bytes;
+        upage += PGSIZE;
+    }
+    return true;
+#else
     file_seek(file, ofs);
     while (read_bytes > 0 || zero_bytes > 0) {
         /* Calculate how to fill this page.
@@ -452,6 +487,7 @@ load_segment(struct file *file, off_t ofs, uint8_t *upage,
         upage += PGSIZE;
     }
     return true;
+#endif
 }
 
 int countWords(char str[]) {
@@ -487,6 +523,16 @@ setup_stack(void **esp, char *file_name) {
     uint8_t *kpage;
     bool success = false;
 
+#ifdef VM
+    /* The stack page is evictable like any other, so build the
+       arguments through its user address. */
+    uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
+    kpage = NULL;
+    success = page_add_file(upage, NULL, 0, 0, true) && page_load(upage);
+    if (!success)
+        return success;
+    *esp = PHYS_BASE;
+#else
     kpage = palloc_get_page(PAL_USER | PAL_ZERO);
     if (kpage != NULL) {
         success = install_page(((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
@@ -497,6 +543,7 @@ setup_stack(void **esp, char *file_name) {
             return success;
         }
     }
+#endif
     int cnt = countWords(file_name);
     int *addresses = malloc((cnt + 1) * sizeof(int));
     char **args = malloc((cnt + 1) * sizeof(char *));
@@ -10,9 +10,14 @@
 #include "filesys/filesys.h"
 #include "process.h"
 #include "filesys/file.h"
+#include "filesys/iovec.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 #include "threads/vaddr.h"
-
-struct semaphore write_syscall_sema,read_syscall_sema;
+#include "threads/synch.h"
+#include "threads/malloc.h"
+#include <string.h>
 
 static void syscall_handler(struct intr_frame *);
 
@@ -38,12 +43,21 @@ static tid_t execute(char *cmd_line);
 
 static uint32_t tell(int fd);
 
+static int fsync(int fd);
+
+/* Lowest fd handed out for files; 0 and 1 are the console. */
+#define FD_MIN 2
+
+/* Number of slots in a process's fd table when first used. */
+#define FD_TABLE_INIT 16
+
+/* -fdl: Maximum number of files a process may have open at once. */
+int fd_limit = FD_LIMIT_DEFAULT;
+
 void syscall_init(void)
 {
     lock_init(&filesys_lock);
     intr_register_int(0x30, 3, INTR_ON, syscall_handler, "syscall");
-    sema_init(&write_syscall_sema, 1);
-    sema_init(&read_syscall_sema, 1);
 }
 
 static bool
@@ -53,13 +67,19 @@ is_valid_uvaddr(const void *uvaddr)
 }
 /* Checks for validity of a user address
    It should be below PHYS_BASE and
-   registered in page directory */
+   registered in page directory.
+   With VM, a page the process has not touched yet is brought in,
+   so that the caller may go on to use its kernel address. */
 bool is_valid_ptr(const void *usr_ptr)
 {
     struct thread *cur = thread_current();
     if (is_valid_uvaddr(usr_ptr))
     {
-        return (pagedir_get_page(cur->pagedir, usr_ptr)) != NULL;
+        if (pagedir_get_page(cur->pagedir, usr_ptr) != NULL)
+            return true;
+#ifdef VM
+        return page_load(usr_ptr);
+#endif
     }
     return false;
 }
@@ -80,8 +100,6 @@ syscall_handler(struct intr_frame *f UNUSED)
     {
         kill();
     }
-    ASSERT(&open_lock != NULL);
-    lock_acquire(&open_lock);
     switch (*(int *)f->esp)
     {
     case SYS_HALT:
@@ -104,7 +122,6 @@ syscall_handler(struct intr_frame *f UNUSED)
     case SYS_WAIT:
     {
         tid_t child_pid = (tid_t *)(*((int *)f->esp + 1));
-        lock_release(&open_lock);
         f->eax = process_wait(child_pid);
         break;
     }
@@ -182,30 +199,70 @@ syscall_handler(struct intr_frame *f UNUSED)
         close_file(fd);
         break;
     }
+    case SYS_FSYNC:
+    {
+        int fd = *((int *)f->esp + 1);
+        f->eax = fsync(fd);
+        break;
+    }
     default:
     {
         kill();
     }
     }
-    if(lock_held_by_current_thread(&open_lock))
-    lock_release(&open_lock);
 }
 
+/* Returns the file open as FD in the current process, or a null
+   pointer if FD is not open. */
 struct file *get_file(int fd)
 {
-    struct file *file = NULL;
-    if (fd == NULL || list_empty(&thread_current()->my_opened_files_list))
-        return file;
-    struct list_elem *file_elem = list_front(&thread_current()->my_opened_files_list);
-    while (file_elem != list_tail(&thread_current()->my_opened_files_list) &&
-           (file = list_entry(file_elem, struct file, file_elem))->fd < fd)
+    struct thread *t = thread_current();
+    if (fd < FD_MIN || fd >= t->fd_cap)
+        return NULL;
+    return t->fd_table[fd];
+}
+
+/* Installs FILE in the lowest free slot of the current process's
+   fd table, growing the table as needed.  Returns the new fd, or
+   -1 if the process is at its fd limit or memory is short. */
+static int fd_alloc(struct file *file)
+{
+    struct thread *t = thread_current();
+    int fd;
+
+    for (fd = t->fd_free; fd < t->fd_cap; fd++)
+        if (t->fd_table[fd] == NULL)
+            break;
+    if (fd >= FD_MIN + fd_limit)
+        return -1;
+    if (fd >= t->fd_cap)
     {
-        file_elem = file_elem->next;
+        int cap = t->fd_cap > 0 ? t->fd_cap * 2 : FD_TABLE_INIT;
+        struct file **table;
+
+        if (cap > FD_MIN + fd_limit)
+            cap = FD_MIN + fd_limit;
+        table = realloc(t->fd_table, cap * sizeof *table);
+        if (table == NULL)
+            return -1;
+        memset(table + t->fd_cap, 0, (cap - t->fd_cap) * sizeof *table);
+        t->fd_table = table;
+        t->fd_cap = cap;
     }
-    if (file_elem != list_tail(&thread_current()->my_opened_files_list) && file->fd == fd)
-        return list_entry(file_elem, struct file, file_elem);
-    else
-        return NULL;
+    t->fd_table[fd] = file;
+    t->fd_free = fd + 1;
+    return fd;
+}
+
+/* Frees FD, which must be open, in the current process's fd
+   table. */
+static void fd_release(int fd)
+{
+    struct thread *t = thread_current();
+
+    t->fd_table[fd] = NULL;
+    if (fd < t->fd_free)
+        t->fd_free = fd;
 }
 
 
@@ -223,7 +280,9 @@ static bool create_file(char *curr_name, off_t initial_size)
     if (!is_valid_ptr(curr_name))
         kill();
     bool res;
+    lock_acquire(&filesys_lock);
     res = filesys_create(curr_name, initial_size);
+    lock_release(&filesys_lock);
     return res;
 }
 
@@ -232,7 +291,9 @@ static int remove_file(char *curr_name)
     if (!is_valid_ptr(curr_name))
         kill();
     int res;
+    lock_acquire(&filesys_lock);
     res = filesys_remove(curr_name);
+    lock_release(&filesys_lock);
     return res;
 }
 
@@ -241,24 +302,26 @@ static int open_file(char *curr_name)
     if (!is_valid_ptr(curr_name))
         kill();
     int res = -1;
+    lock_acquire(&filesys_lock);
     struct file *curr_file = filesys_open(curr_name);
+    lock_release(&filesys_lock);
     if (curr_file != NULL)
     {
-        list_push_back(&thread_current()->my_opened_files_list, &curr_file->file_elem);
-        thread_current()->fd++;
-        curr_file->fd = thread_current()->fd;
-        res = thread_current()->fd;
+        res = fd_alloc(curr_file);
+        if (res == -1)
+            file_close(curr_file);
     }
     return res;
 }
 void
 close_all_files(){
-    struct list *l = &thread_current()->my_opened_files_list;
-    for (struct list_elem * e = list_begin(l); e != list_end(l);) {
-        struct file * f = list_entry(e, struct file, file_elem);
-        e = list_next(e);
-        file_close(f);
-    }
+    struct thread *t = thread_current();
+    for (int fd = FD_MIN; fd < t->fd_cap; fd++)
+        file_close(t->fd_table[fd]);
+    free(t->fd_table);
+    t->fd_table = NULL;
+    t->fd_cap = 0;
+    t->fd_free = FD_MIN;
 
 }
 void ourExit(int status)
@@ -271,12 +334,64 @@ void ourExit(int status)
         file_close(thread_current()->my_exec_file); //close file that was opened in process.c/load function to decrement deny-inode-write again
     }
     close_all_files();
-    if(lock_held_by_current_thread(&open_lock)) {
-          lock_release(&open_lock);
-    }
     thread_exit();
 }
 
+/* Reads (if WRITE is false) or writes SIZE bytes between FILE, at
+   its current position, and the user buffer at BUFFER, which the
+   caller has already checked is mapped.  The buffer is handed to
+   the file system a page at a time, by kernel address, so large
+   transfers can go straight between the disk and user memory.
+   With VM, each page is pinned in its frame while the file system
+   uses it.  Returns the number of bytes transferred. */
+static off_t file_transfer(struct file *file, uint8_t *buffer, unsigned size,
+                           bool write)
+{
+    struct iovec iov[IOV_MAX];
+    off_t total = 0;
+
+    while (size > 0)
+    {
+        size_t cnt = 0;
+        unsigned batch = 0;
+        off_t done;
+
+        while (batch < size && cnt < IOV_MAX)
+        {
+            uint8_t *upage = buffer + batch;
+            unsigned left = PGSIZE - pg_ofs(upage);
+            if (left > size - batch)
+                left = size - batch;
+#ifdef VM
+            iov[cnt].base = page_pin(upage, !write);
+            if (iov[cnt].base == NULL)
+                break;
+#else
+            iov[cnt].base = pagedir_get_page(thread_current()->pagedir, upage);
+#endif
+            iov[cnt].size = left;
+            cnt++;
+            batch += left;
+        }
+
+        if (cnt == 0)
+            break;
+
+        done = write ? file_write_iov(file, iov, cnt)
+                     : file_read_iov(file, iov, cnt);
+#ifdef VM
+        while (cnt-- > 0)
+            page_unpin(buffer + iov_size(iov, cnt));
+#endif
+        total += done;
+        if ((unsigned) done < batch)
+            break;
+        buffer += batch;
+        size -= batch;
+    }
+    return total;
+}
+
 static uint32_t write(int fd, void *buffer, unsigned int size) {
     unsigned buffer_size = size;
     void *buffer_tmp = buffer;
@@ -327,7 +442,7 @@ static uint32_t write(int fd, void *buffer, unsigned int size) {
             //sema_down(&write_syscall_sema);
             //printf("file %d\n" ,file->deny_write);
 
-            res = file_write(file, buffer, size);
+            res = file_transfer(file, buffer, size, true);
             //printf("%d\n",res);
             //sema_up(&write_syscall_sema);
         }
@@ -354,8 +469,19 @@ static uint32_t read(int fd, void *buffer, unsigned size)
     while (buffer_tmp != NULL)
     {
         //printf("hey");
+        /* The kernel ignores page protection, so check that we may
+           write the buffer: a read-only page may be shared with
+           other processes.  With VM, ask the supplemental page
+           table, since the page may be evicted at any moment. */
         if (!is_valid_ptr(buffer_tmp))
             kill();
+#ifdef VM
+        if (!page_is_writable(buffer_tmp))
+            kill();
+#else
+        if (!pagedir_is_writable(thread_current()->pagedir, buffer_tmp))
+            kill();
+#endif
 
         /* Advance */
         if (buffer_size > PGSIZE)
@@ -384,10 +510,7 @@ static uint32_t read(int fd, void *buffer, unsigned size)
     {
         struct file *file = get_file(fd);
         if (file != NULL) {
-            sema_down(&read_syscall_sema);
-            int result_size = file_read(file, buffer, size);
-            sema_up(&read_syscall_sema);
-            return result_size ;
+            return file_transfer(file, buffer, size, false);
         }
         }
 
@@ -433,8 +556,19 @@ static void close_file(int fd)
     struct file *file = get_file(fd);
     if (file != NULL)
     {
-        list_remove(&file->file_elem);
+        fd_release(fd);
         file_close(file);
     }
     //lock_release(&filesys_lock);
 }
+
+/* Waits until all data written to FD is on disk.  Returns 0 on
+   success, -1 if FD is not an open file. */
+static int fsync(int fd)
+{
+    struct file *file = get_file(fd);
+    if (file == NULL)
+        return -1;
+    file_flush(file);
+    return 0;
+}
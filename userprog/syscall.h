@@ -3,5 +3,20 @@
 
 void syscall_init (void);
 void ourExit(int status);
+
+/* fsync(fd) is not in lib/syscall-nr.h; it takes the next free
+   number after the file system calls. */
+#ifndef SYS_FSYNC
+#define SYS_FSYNC (SYS_INUMBER + 1)
+#endif
+
+/* Default for fd_limit, the per-process open file limit. */
+#ifndef FD_LIMIT_DEFAULT
+#define FD_LIMIT_DEFAULT 128
+#endif
+extern int fd_limit;
+
+/* Serializes file system metadata operations: create, remove and
+   open.  File data I/O is synchronized per inode instead. */
 struct lock filesys_lock;
 #endif /* userprog/syscall.h */
@@ -0,0 +1,205 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+
+/* Frame table: every user frame holding a page that may be
+   evicted, in no particular order. */
+static struct list frames;
+static struct lock frames_lock;
+
+/* Clock hand: the next frame to consider for eviction, or the
+   list tail to wrap around to the front. */
+static struct list_elem *hand;
+
+/* Signaled, with frames_lock, when a frame may have become free or
+   evictable. */
+static struct condition frames_changed;
+
+static void *evict (bool *busy);
+
+/* Initializes the frame table. */
+void
+frame_init (void)
+{
+  list_init (&frames);
+  lock_init (&frames_lock);
+  cond_init (&frames_changed);
+  hand = list_end (&frames);
+}
+
+/* Obtains a frame of user memory, as palloc_get_page() with FLAGS
+   plus PAL_USER would, evicting another process's page if the
+   user pool is exhausted.  If every page is pinned or busy for the
+   moment, waits until one is unpinned or released.
+
+   If PAGE is non-null, records the frame as holding PAGE, for the
+   running process, so that it can be evicted in turn once PAGE is
+   mapped.  The caller must hold PAGE's lock.  Otherwise the frame
+   is never evicted and the caller frees it with
+   palloc_free_page(), then calls frame_wake().
+
+   Returns the frame's kernel address, or a null pointer if no
+   frame can be found because every evictable page is dirty and
+   swap is full or missing, or if waiting is needed but the
+   running thread has pages pinned (see page_pin()). */
+void *
+frame_alloc (struct page *page, enum palloc_flags flags)
+{
+  void *kpage = palloc_get_page (flags | PAL_USER);
+
+  if (kpage == NULL)
+    {
+      lock_acquire (&frames_lock);
+      for (;;)
+        {
+          bool busy;
+
+          /* A frame may have been freed while we waited. */
+          kpage = palloc_get_page (flags | PAL_USER);
+          if (kpage != NULL)
+            break;
+          kpage = evict (&busy);
+          if (kpage != NULL)
+            {
+              if (flags & PAL_ZERO)
+                memset (kpage, 0, PGSIZE);
+              break;
+            }
+          if (!busy || thread_current ()->pinned_cnt > 0)
+            break;
+          cond_wait (&frames_changed, &frames_lock);
+        }
+      lock_release (&frames_lock);
+      if (kpage == NULL)
+        return NULL;
+    }
+
+  if (page != NULL)
+    {
+      struct frame *f = malloc (sizeof *f);
+      if (f == NULL)
+        {
+          palloc_free_page (kpage);
+          frame_wake ();
+          return NULL;
+        }
+      f->kpage = kpage;
+      f->pagedir = thread_current ()->pagedir;
+      f->page = page;
+      page->frame = f;
+
+      lock_acquire (&frames_lock);
+      list_push_back (&frames, &f->elem);
+      lock_release (&frames_lock);
+    }
+  return kpage;
+}
+
+/* Frees the frame holding PAGE, which the caller must already
+   have unmapped.  The caller must hold PAGE's lock. */
+void
+frame_free (struct page *page)
+{
+  struct frame *f = page->frame;
+
+  lock_acquire (&frames_lock);
+  if (hand == &f->elem)
+    hand = list_next (hand);
+  list_remove (&f->elem);
+  lock_release (&frames_lock);
+
+  page->frame = NULL;
+  palloc_free_page (f->kpage);
+  free (f);
+  frame_wake ();
+}
+
+/* Wakes threads waiting in frame_alloc() for a frame, after a user
+   frame has been freed or a page unpinned or unlocked. */
+void
+frame_wake (void)
+{
+  lock_acquire (&frames_lock);
+  cond_broadcast (&frames_changed, &frames_lock);
+  lock_release (&frames_lock);
+}
+
+/* Chooses a frame by the second-chance ("clock") algorithm,
+   evicts its page, and returns the now unused frame.  Frames
+   whose pages were accessed since the hand last passed get their
+   accessed bits cleared and are passed over, as are pinned pages
+   and pages busy being loaded or freed.
+
+   The caller must hold frames_lock.  It is released while the
+   victim is written to swap, so that other threads may use the
+   frame table meanwhile; the victim is off the table and its
+   page locked for the duration.
+
+   Returns a null pointer if no page could be evicted after two
+   full turns.  Then sets *BUSY to true if some page was passed
+   over only because it was pinned or busy, so that waiting may
+   help. */
+static void *
+evict (bool *busy)
+{
+  size_t n = 2 * list_size (&frames);
+
+  *busy = false;
+  while (n-- > 0)
+    {
+      struct frame *f;
+      struct page *p;
+      void *kpage;
+      bool evicted;
+
+      if (hand == list_end (&frames))
+        hand = list_begin (&frames);
+      if (hand == list_end (&frames))
+        break;
+      f = list_entry (hand, struct frame, elem);
+      hand = list_next (hand);
+
+      p = f->page;
+      if (!lock_try_acquire (&p->lock))
+        {
+          *busy = true;
+          continue;
+        }
+      if (p->pin_cnt > 0)
+        {
+          *busy = true;
+          lock_release (&p->lock);
+          continue;
+        }
+      if (pagedir_is_accessed (f->pagedir, p->upage))
+        {
+          pagedir_set_accessed (f->pagedir, p->upage, false);
+          lock_release (&p->lock);
+          continue;
+        }
+
+      list_remove (&f->elem);
+      lock_release (&frames_lock);
+      evicted = page_evict (p, f->pagedir);
+      lock_acquire (&frames_lock);
+      if (!evicted)
+        {
+          list_push_back (&frames, &f->elem);
+          lock_release (&p->lock);
+          continue;
+        }
+
+      p->frame = NULL;
+      lock_release (&p->lock);
+      kpage = f->kpage;
+      free (f);
+      return kpage;
+    }
+  return NULL;
+}
@@ -0,0 +1,25 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <list.h>
+#include <stdint.h>
+#include "threads/palloc.h"
+
+struct page;
+
+/* A frame of user memory holding a process's page, which the
+   frame table may evict to make room for another. */
+struct frame
+  {
+    struct list_elem elem;      /* Element in frame table. */
+    void *kpage;                /* Kernel address of the frame. */
+    uint32_t *pagedir;          /* Page directory mapping it. */
+    struct page *page;          /* Page held. */
+  };
+
+void frame_init (void);
+void *frame_alloc (struct page *, enum palloc_flags);
+void frame_free (struct page *);
+void frame_wake (void);
+
+#endif /* vm/frame.h */
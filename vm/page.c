@@ -0,0 +1,312 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/share.h"
+#include "vm/swap.h"
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_free;
+static struct page *page_lookup (const void *upage);
+static bool load (struct page *);
+
+/* Creates an empty supplemental page table for the running
+   process.  Returns true if successful, false if memory could
+   not be allocated. */
+bool
+page_table_create (void)
+{
+  return hash_init (&thread_current ()->pages, page_hash, page_less, NULL);
+}
+
+/* Destroys the running process's supplemental page table, given
+   its page directory PD, which must no longer be active.  Unmaps
+   and frees the frames and swap slots that its pages occupy, and
+   drops the process's references to shared pages. */
+void
+page_table_destroy (uint32_t *pd)
+{
+  struct hash *pages = &thread_current ()->pages;
+  struct hash_iterator i;
+
+  hash_first (&i, pages);
+  while (hash_next (&i))
+    {
+      struct page *p = hash_entry (hash_cur (&i), struct page, hash_elem);
+
+      /* Wait for any eviction in progress. */
+      lock_acquire (&p->lock);
+      if (p->frame != NULL)
+        {
+          pagedir_clear_page (pd, p->upage);
+          frame_free (p);
+        }
+      else if (p->shared != NULL)
+        {
+          pagedir_clear_page (pd, p->upage);
+          share_put (p->shared, p->ofs);
+        }
+      if (p->swap_slot != SWAP_NONE)
+        swap_free (p->swap_slot);
+      lock_release (&p->lock);
+    }
+  frame_wake ();
+  hash_destroy (pages, page_free);
+}
+
+/* Records that user page UPAGE of the running process is to be
+   filled, the first time it is touched, with READ_BYTES bytes
+   read from FILE starting at offset OFS, followed by zeros.  If
+   READ_BYTES is 0, FILE may be null.  The process may write the
+   page if WRITABLE is true.  FILE must remain open for as long as
+   the process runs.
+
+   Returns true if successful, false if UPAGE was already added
+   or memory could not be allocated. */
+bool
+page_add_file (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes, bool writable)
+{
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (read_bytes <= PGSIZE);
+  ASSERT (file != NULL || read_bytes == 0);
+
+  p = malloc (sizeof *p);
+  if (p == NULL)
+    return false;
+  p->upage = upage;
+  p->writable = writable;
+  p->file = read_bytes > 0 ? file : NULL;
+  p->ofs = ofs;
+  p->read_bytes = read_bytes;
+  lock_init (&p->lock);
+  p->frame = NULL;
+  p->swap_slot = SWAP_NONE;
+  p->pin_cnt = 0;
+  p->shared = NULL;
+  if (hash_insert (&thread_current ()->pages, &p->hash_elem) != NULL)
+    {
+      free (p);
+      return false;
+    }
+  return true;
+}
+
+/* Brings the page containing user address UADDR into memory and
+   maps it in the running process's page directory, if the
+   process's supplemental page table has it.  Returns true if the
+   page is now mapped, false if it is not part of the process's
+   address space or could not be brought in. */
+bool
+page_load (const void *uaddr)
+{
+  struct page *p = page_lookup (pg_round_down (uaddr));
+  bool success;
+
+  if (p == NULL)
+    return false;
+  lock_acquire (&p->lock);
+  success = load (p);
+  lock_release (&p->lock);
+  frame_wake ();
+  return success;
+}
+
+/* Brings in the page containing user address UADDR, like
+   page_load(), and pins it in its frame until a matching call to
+   page_unpin(), so that the kernel may use the frame's kernel
+   address meanwhile.  If WRITE is true, the caller is about to
+   write the page through that address, so it is marked dirty.
+   Returns the kernel address corresponding to UADDR, or a null
+   pointer if the page cannot be brought in, or if WRITE is true
+   and the page is read-only.
+
+   A thread that already has pages pinned does not wait for a
+   frame to bring this one in, since other threads might be
+   waiting for its pins in turn; it gets a null pointer instead
+   and should unpin before trying again. */
+void *
+page_pin (const void *uaddr, bool write)
+{
+  struct thread *t = thread_current ();
+  struct page *p = page_lookup (pg_round_down (uaddr));
+  void *kaddr = NULL;
+
+  if (p == NULL || (write && !p->writable))
+    return NULL;
+  lock_acquire (&p->lock);
+  if (load (p))
+    {
+      p->pin_cnt++;
+      t->pinned_cnt++;
+      if (write)
+        pagedir_set_dirty (t->pagedir, p->upage, true);
+      kaddr = pagedir_get_page (t->pagedir, uaddr);
+    }
+  lock_release (&p->lock);
+  frame_wake ();
+  return kaddr;
+}
+
+/* Unpins the page containing user address UADDR, pinned by
+   page_pin(). */
+void
+page_unpin (const void *uaddr)
+{
+  struct page *p = page_lookup (pg_round_down (uaddr));
+
+  ASSERT (p != NULL);
+  lock_acquire (&p->lock);
+  ASSERT (p->pin_cnt > 0);
+  p->pin_cnt--;
+  thread_current ()->pinned_cnt--;
+  lock_release (&p->lock);
+  frame_wake ();
+}
+
+/* Returns true if user address UADDR lies in a page of the
+   running process that the process may write, whether or not the
+   page is in memory. */
+bool
+page_is_writable (const void *uaddr)
+{
+  struct page *p = page_lookup (pg_round_down (uaddr));
+  return p != NULL && p->writable;
+}
+
+/* Evicts page P from its frame on behalf of the frame table,
+   unmapping it from page directory PD.  Writes it to swap if it
+   has been modified, otherwise lets it be read back from its file
+   or zeroed again.  Returns true if successful, false if P had to
+   be left in place because swap is full or missing.  The caller
+   must hold P's lock and frees the frame afterward. */
+bool
+page_evict (struct page *p, uint32_t *pd)
+{
+  void *kpage = p->frame->kpage;
+
+  /* Unmap first, so that the process cannot modify the page
+     while we save it.  The dirty bit survives unmapping. */
+  pagedir_clear_page (pd, p->upage);
+  if (pagedir_is_dirty (pd, p->upage))
+    {
+      p->swap_slot = swap_out (kpage);
+      if (p->swap_slot == SWAP_NONE)
+        {
+          pagedir_set_page (pd, p->upage, kpage, p->writable);
+          pagedir_set_dirty (pd, p->upage, true);
+          return false;
+        }
+    }
+  return true;
+}
+
+/* Brings page P into memory, if it is not already, and maps it in
+   the running process's page directory.  Returns true if
+   successful.  The caller must hold P's lock. */
+static bool
+load (struct page *p)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  bool dirty = false;
+  uint8_t *kpage;
+
+  if (p->frame != NULL || p->shared != NULL)
+    return true;
+
+  /* Map a read-only file page shared, if possible. */
+  if (p->file != NULL && !p->writable)
+    {
+      kpage = share_get (p->file, p->ofs, p->read_bytes);
+      if (kpage != NULL)
+        {
+          if (!pagedir_set_page (pd, p->upage, kpage, false))
+            {
+              share_put (file_get_inode (p->file), p->ofs);
+              return false;
+            }
+          p->shared = file_get_inode (p->file);
+          return true;
+        }
+    }
+
+  kpage = frame_alloc (p, (p->file != NULL || p->swap_slot != SWAP_NONE
+                           ? 0 : PAL_ZERO));
+  if (kpage == NULL)
+    return false;
+  if (p->swap_slot != SWAP_NONE)
+    {
+      /* A page read back from swap differs from its file, so it
+         must go back to swap if it is evicted again, modified or
+         not. */
+      swap_in (p->swap_slot, kpage);
+      p->swap_slot = SWAP_NONE;
+      dirty = true;
+    }
+  else if (p->file != NULL)
+    {
+      if (file_read_at (p->file, kpage, p->read_bytes, p->ofs)
+          != (off_t) p->read_bytes)
+        {
+          frame_free (p);
+          return false;
+        }
+      memset (kpage + p->read_bytes, 0, PGSIZE - p->read_bytes);
+    }
+
+  if (!pagedir_set_page (pd, p->upage, kpage, p->writable))
+    {
+      frame_free (p);
+      return false;
+    }
+
+  if (dirty)
+    pagedir_set_dirty (pd, p->upage, true);
+  return true;
+}
+
+/* Returns the running process's page at UPAGE, or a null pointer
+   if it has none. */
+static struct page *
+page_lookup (const void *upage)
+{
+  struct page key;
+  struct hash_elem *e;
+
+  key.upage = (void *) upage;
+  e = hash_find (&thread_current ()->pages, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Hashes a page by its user address. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (e, struct page, hash_elem);
+  return hash_bytes (&p->upage, sizeof p->upage);
+}
+
+/* Orders pages by user address. */
+static bool
+page_less (const struct hash_elem *a, const struct hash_elem *b,
+           void *aux UNUSED)
+{
+  return (hash_entry (a, struct page, hash_elem)->upage
+          < hash_entry (b, struct page, hash_elem)->upage);
+}
+
+/* Frees a page table entry. */
+static void
+page_free (struct hash_elem *e, void *aux UNUSED)
+{
+  free (hash_entry (e, struct page, hash_elem));
+}
@@ -0,0 +1,55 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+/* A page of a process's address space that is not necessarily in
+   memory, with what is needed to bring it in.  Each process has a
+   table of these, its supplemental page table, alongside its page
+   directory.  A page is installed in the page directory the first
+   time the process touches it, and may later be evicted from its
+   frame to swap, or simply dropped if it can be read back from
+   FILE or is all zeros. */
+struct page
+  {
+    struct hash_elem hash_elem; /* Element in thread's page table. */
+    void *upage;                /* User virtual address. */
+    bool writable;              /* May the process write the page? */
+
+    /* Initial contents: READ_BYTES bytes read from FILE at OFS,
+       followed by zeros to the end of the page.  FILE is null
+       for a page that starts out all zeros. */
+    struct file *file;          /* File to read from. */
+    off_t ofs;                  /* Offset in FILE. */
+    size_t read_bytes;          /* Bytes to read. */
+
+    /* Where the page is now.  Guarded by LOCK, which the frame
+       table also takes, without waiting, to evict the page. */
+    struct lock lock;           /* Guards the members below. */
+    struct frame *frame;        /* Frame holding it, or null. */
+    size_t swap_slot;           /* Swap slot holding it, or SWAP_NONE. */
+    int pin_cnt;                /* Evictable only while 0. */
+
+    /* Read-only file pages are shared with other processes running
+       the same executable, through vm/share.c, and are never
+       evicted. */
+    struct inode *shared;       /* FILE's inode if mapped shared. */
+  };
+
+bool page_table_create (void);
+void page_table_destroy (uint32_t *pd);
+
+bool page_add_file (void *upage, struct file *, off_t ofs,
+                    size_t read_bytes, bool writable);
+bool page_load (const void *uaddr);
+void *page_pin (const void *uaddr, bool write);
+void page_unpin (const void *uaddr);
+bool page_is_writable (const void *uaddr);
+bool page_evict (struct page *, uint32_t *pd);
+
+#endif /* vm/page.h */
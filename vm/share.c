@@ -0,0 +1,187 @@
+#include "vm/share.h"
+#include <debug.h>
+#include <hash.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+
+/* A read-only page of an executable, mapped into every process
+   running it.  Processes find it by the file's inode and the
+   page's offset in the file, so they share it however they
+   opened the file. */
+struct shared_page
+  {
+    struct hash_elem hash_elem; /* Element in shared_pages. */
+    struct inode *inode;        /* File's inode. */
+    off_t ofs;                  /* Offset of page in file. */
+    size_t read_bytes;          /* Bytes read from file, rest zeros. */
+    void *kpage;                /* The page's contents. */
+    int ref_cnt;                /* Number of processes mapping it. */
+
+    /* Our own handle on the file, with writes denied, so that its
+       contents cannot change for as long as the page exists. */
+    struct file *file;
+  };
+
+/* Shared pages, hashed by inode and offset. */
+static struct hash shared_pages;
+static struct lock shared_pages_lock;
+
+static hash_hash_func shared_page_hash;
+static hash_less_func shared_page_less;
+static struct shared_page *shared_page_lookup (struct inode *, off_t);
+
+/* Initializes the shared page table. */
+void
+share_init (void)
+{
+  if (!hash_init (&shared_pages, shared_page_hash, shared_page_less, NULL))
+    PANIC ("could not allocate shared page table");
+  lock_init (&shared_pages_lock);
+}
+
+/* Returns a page holding READ_BYTES bytes read from FILE at OFS,
+   followed by zeros, shared with every other process that maps
+   the same page of the same file.  Reads the page in if no
+   process has it yet.  The page must be mapped read-only and
+   eventually released with share_put().  Returns a null pointer
+   if memory runs out or the page cannot be read. */
+void *
+share_get (struct file *file, off_t ofs, size_t read_bytes)
+{
+  struct inode *inode = file_get_inode (file);
+  struct shared_page *sp;
+  void *kpage;
+
+  ASSERT (ofs % PGSIZE == 0);
+  ASSERT (read_bytes <= PGSIZE);
+
+  lock_acquire (&shared_pages_lock);
+  sp = shared_page_lookup (inode, ofs);
+  if (sp != NULL && sp->read_bytes == read_bytes)
+    {
+      sp->ref_cnt++;
+      lock_release (&shared_pages_lock);
+      return sp->kpage;
+    }
+  lock_release (&shared_pages_lock);
+  if (sp != NULL)
+    return NULL;
+
+  /* Read the page without holding the lock, so that processes
+     faulting in other pages need not wait for the disk. */
+  sp = malloc (sizeof *sp);
+  kpage = frame_alloc (NULL, 0);
+  if (sp == NULL || kpage == NULL)
+    goto fail;
+  if (file_read_at (file, kpage, read_bytes, ofs) != (off_t) read_bytes)
+    goto fail;
+  memset ((uint8_t *) kpage + read_bytes, 0, PGSIZE - read_bytes);
+  sp->file = file_reopen (file);
+  if (sp->file == NULL)
+    goto fail;
+  file_deny_write (sp->file);
+  sp->inode = inode;
+  sp->ofs = ofs;
+  sp->read_bytes = read_bytes;
+  sp->kpage = kpage;
+  sp->ref_cnt = 1;
+
+  /* Another process may have read the same page meanwhile. */
+  lock_acquire (&shared_pages_lock);
+  if (hash_insert (&shared_pages, &sp->hash_elem) != NULL)
+    {
+      struct shared_page *other = shared_page_lookup (inode, ofs);
+      void *other_kpage = NULL;
+      if (other->read_bytes == read_bytes)
+        {
+          other->ref_cnt++;
+          other_kpage = other->kpage;
+        }
+      lock_release (&shared_pages_lock);
+      file_close (sp->file);
+      palloc_free_page (kpage);
+      frame_wake ();
+      free (sp);
+      return other_kpage;
+    }
+  lock_release (&shared_pages_lock);
+  return kpage;
+
+ fail:
+  if (kpage != NULL)
+    {
+      palloc_free_page (kpage);
+      frame_wake ();
+    }
+  free (sp);
+  return NULL;
+}
+
+/* Releases a reference, obtained from share_get(), to the page at
+   OFS in the file with the given INODE, freeing the page when no
+   process maps it any longer.  The caller must already have
+   unmapped it.  The file itself may have been closed since. */
+void
+share_put (struct inode *inode, off_t ofs)
+{
+  struct shared_page *sp;
+
+  lock_acquire (&shared_pages_lock);
+  sp = shared_page_lookup (inode, ofs);
+  ASSERT (sp != NULL && sp->ref_cnt > 0);
+  if (--sp->ref_cnt > 0)
+    sp = NULL;
+  else
+    hash_delete (&shared_pages, &sp->hash_elem);
+  lock_release (&shared_pages_lock);
+
+  if (sp != NULL)
+    {
+      file_close (sp->file);
+      palloc_free_page (sp->kpage);
+      frame_wake ();
+      free (sp);
+    }
+}
+
+/* Returns the shared page of INODE at OFS, or a null pointer if
+   there is none.  The caller must hold shared_pages_lock. */
+static struct shared_page *
+shared_page_lookup (struct inode *inode, off_t ofs)
+{
+  struct shared_page key;
+  struct hash_elem *e;
+
+  key.inode = inode;
+  key.ofs = ofs;
+  e = hash_find (&shared_pages, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct shared_page, hash_elem) : NULL;
+}
+
+/* Hashes a shared page by inode and offset. */
+static unsigned
+shared_page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct shared_page *sp = hash_entry (e, struct shared_page,
+                                             hash_elem);
+  return hash_bytes (&sp->inode, sizeof sp->inode) ^ hash_int (sp->ofs);
+}
+
+/* Orders shared pages by inode, then offset. */
+static bool
+shared_page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+                  void *aux UNUSED)
+{
+  const struct shared_page *a = hash_entry (a_, struct shared_page,
+                                            hash_elem);
+  const struct shared_page *b = hash_entry (b_, struct shared_page,
+                                            hash_elem);
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  return a->ofs < b->ofs;
+}
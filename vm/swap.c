@@ -0,0 +1,83 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include "devices/block.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Number of sectors in a swap slot, which holds one page. */
+#define SLOT_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Swap device, or a null pointer if there is none. */
+static struct block *swap_device;
+
+/* Swap slots in use, one bit per slot. */
+static struct bitmap *swap_slots;
+static struct lock swap_lock;
+
+static void transfer (size_t slot, void *kpage, bool write);
+
+/* Initializes swapping to the block device in the BLOCK_SWAP role.
+   Without one, pages that would need swapping are simply never
+   evicted. */
+void
+swap_init (void)
+{
+  lock_init (&swap_lock);
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device == NULL)
+    return;
+  swap_slots = bitmap_create (block_size (swap_device) / SLOT_SECTORS);
+  if (swap_slots == NULL)
+    PANIC ("could not allocate swap slot bitmap");
+}
+
+/* Writes the page at KPAGE to a free swap slot and returns the
+   slot, or SWAP_NONE if there is no free slot. */
+size_t
+swap_out (const void *kpage)
+{
+  size_t slot;
+
+  if (swap_slots == NULL)
+    return SWAP_NONE;
+  lock_acquire (&swap_lock);
+  slot = bitmap_scan_and_flip (swap_slots, 0, 1, false);
+  lock_release (&swap_lock);
+  if (slot == BITMAP_ERROR)
+    return SWAP_NONE;
+
+  transfer (slot, (void *) kpage, true);
+  return slot;
+}
+
+/* Reads the page in swap slot SLOT into KPAGE and frees SLOT. */
+void
+swap_in (size_t slot, void *kpage)
+{
+  transfer (slot, kpage, false);
+  swap_free (slot);
+}
+
+/* Frees swap slot SLOT without reading it. */
+void
+swap_free (size_t slot)
+{
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (swap_slots, slot));
+  bitmap_reset (swap_slots, slot);
+  lock_release (&swap_lock);
+}
+
+/* Moves a page between KPAGE and swap slot SLOT, as a single
+   request, writing to the slot if WRITE is true. */
+static void
+transfer (size_t slot, void *kpage, bool write)
+{
+  struct block_request r;
+
+  block_request_init (&r, write, slot * SLOT_SECTORS, SLOT_SECTORS, kpage,
+                      NULL, NULL);
+  block_submit (swap_device, &r);
+  block_wait (&r);
+}